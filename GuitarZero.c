@@ -1,8 +1,13 @@
+#ifdef GZ_MOCK_GPIO
+#include "gpiolib_mock.h"	//in-memory register file so the game code runs off the Pi
+#else
 #include "gpiolib_addr.h"
 #include "gpiolib_reg.h"
 #include "gpiolib_reg.c"
+#endif
 
 #include <stdint.h>
+#include <stddef.h>		//for offsetof()
 #include <stdio.h>		//for the printf() function
 #include <fcntl.h>
 #include <linux/watchdog.h> 	//needed for the watchdog specific constants
@@ -11,27 +16,70 @@
 #include <stdlib.h> 		//for atoi
 #include <time.h> 		//for time_t and the time() function
 #include <sys/time.h>           //for gettimeofday()
+#include <sys/stat.h>		//for fstat()
 #include <ao/ao.h>
+#include <alsa/asoundlib.h>	//for the direct ALSA output backend
 #include <mpg123.h>
 #include <math.h>
-
-#define BITS 8
+#include <string.h>		//for strcmp() and strlen()
+#include <errno.h>
+#include <dirent.h>		//for scanning the log directory
+#include <pthread.h>		//for the log compression thread
+#include <zlib.h>		//for compressing old log segments
+#include <sys/resource.h>	//for setpriority()
+#include <sys/syscall.h>	//for SYS_gettid
+#include <sys/mman.h>		//for shm_open() and mmap()
+#include "GuitarZeroState.h"	//the live game state shared with spectator screens
+
+//Output format every sound cue is decoded to
+#define CUE_RATE 44100
+#define CUE_CHANNELS 2
+#define CUE_FRAME_BYTES (CUE_CHANNELS*2)
+
+//The audio output backends that can be picked with AUDIO_BACKEND in the config file
+#define AUDIO_LIBAO 0
+#define AUDIO_ALSA 1
 
 typedef int bool; //allows us to use boolean variables in the C programming language
 #define true 1 //defines true
 #define false 0 //defines false
 #define DIODEPIN 22 //defines the gpio pin used for the input from the diode pin
-
-/*A print message macro used to write lines to the log file to condense 
-later code
+#define MAX_ROWS 60 //the most rows a song can have
+#define MAX_PATH_LENGTH 50 //the longest path in the config file, including the null character
+#define ARENA_ALIGN 64 //every block from the session arena starts on a cache line
+
+//The songs assignSong can pick, used as indexes into songTracks
+#define EASY_SONG 0
+#define MEDIUM_SONG 1
+#define HARD_SONG 2
+
+//WSOLA time stretch settings, in frames: the window overlap-added for each output hop, the
+//output hop, and how far from the nominal position the best matching window is searched for
+#define STRETCH_WINDOW 1024
+#define STRETCH_HOP (STRETCH_WINDOW/2)
+#define STRETCH_TOLERANCE 256
+
+//The directory holding the config, score and song files. It can be overridden at compile
+//time (the benchmark points it at a scratch directory)
+#ifndef HOME_DIR
+#define HOME_DIR "/home/pi/"
+#endif
+
+/*A print message macro used to write lines to a rotating log (struct logger) to
+condense later code
 */
-#define PRINT_MSG(file, time, programName, str) \
+#define LOG_MSG(log, time, programName, str) \
 	do{ \
 			getTime(time); \
-			fprintf(file, "%s : %s : %s\n\n", time, programName, str); \
-			fflush(file); \
+			logWrite(log, time, programName, str); \
 	}while(0)
 
+//Size of the buffer each log gathers lines in before writing them out
+#define LOG_BUFFER_SIZE 8192
+
+//Number of closed log segments that can wait for the compression thread
+#define COMPRESS_QUEUE_SIZE 16
+
 /*A structure that represents a single row. It contains the integer statuses that 
 represent the states of the LEDs in that row
 */
@@ -66,6 +114,115 @@ struct ledPins
 	int led23;
 };
 
+/*A structure for one interval of a compiled chart. set and clr are the GPSET and GPCLR
+words that show the two LED rows for the interval, and expect is the GPLEV value the
+buttons should have (they read 0 when pressed) for the row to be judged correct
+*/
+struct rowMasks
+{
+	uint32_t set;
+	uint32_t clr;
+	uint32_t expect;
+};
+
+/*A structure for a chart that has been turned into register masks for a particular set of
+pins by compileChart. There is one more interval than rows, for the display after the
+last row. care has a bit set for every button pin
+*/
+struct compiledChart
+{
+	struct rowMasks rows[MAX_ROWS + 1];
+	uint32_t care;
+	int length;
+};
+
+/*A structure for a sound cue that has been decoded into memory. The samples are always
+16 bit, CUE_CHANNELS channels at CUE_RATE
+*/
+struct soundCue
+{
+	unsigned char* pcm;
+	size_t size; //in bytes
+};
+
+/*A structure for the optional parameters in the config file. Unlike the six parameters
+read by readConfig, these are found by name and keep their default value when they are
+missing, so older config files still work
+*/
+struct options
+{
+	long logMaxBytes; //a log segment is rotated once it would grow past this size
+	int logMaxAge; //a log segment is rotated once it is this many seconds old
+	int logMaxSegments; //number of closed segments kept for each log, older ones are deleted
+	int logFlushBytes; //the game log is flushed to the card once this many bytes are waiting
+	int audioBackend; //AUDIO_LIBAO or AUDIO_ALSA
+	char alsaDevice[50]; //ALSA PCM name, e.g. default, hw:0,0 or null
+	int alsaPeriodFrames; //requested ALSA period size, smaller means lower latency
+	int alsaBufferFrames; //requested ALSA buffer size
+	int alsaMmap; //1 writes straight into the ALSA buffer with mmap, 0 uses snd_pcm_writei
+	int practiceSpeed; //percent of normal speed in practice mode, 100 is the normal game
+	long arenaBytes; //size of the session arena, which holds the sound cues and the backing track
+	int resumeWindow; //a song checkpointed at most this many seconds ago is resumed on startup, 0 never resumes
+	int checkpointSync; //1 flushes every checkpoint to the card, so it survives a reset of the Pi
+};
+
+/*A structure for the session arena: one block allocated at startup that the sound cues,
+the backing track and the time stretcher's buffers are carved from, so nothing is allocated
+once the game is running. Memory is handed out in order and given back all at once by
+going back to a mark. The lock lets the startup steps decode cues at the same time
+*/
+struct arena
+{
+	unsigned char* base;
+	size_t size;
+	size_t used;
+	size_t peak; //most that has ever been in use, to help size ARENA_BYTES
+	pthread_mutex_t lock;
+};
+
+/*A structure for the audio output. Only the fields for the selected backend are used.
+For ALSA it also keeps the measured output latency (the delay reported by the device
+while a cue plays) and the number of underruns
+*/
+struct audioOutput
+{
+	int backend;
+	ao_device* ao;
+	snd_pcm_t* pcm;
+	snd_pcm_uframes_t periodFrames;
+	snd_pcm_uframes_t bufferFrames;
+	bool mmap;
+	long xruns;
+	double delaySum; //sum of the delays measured, in frames
+	long delaySamples; //number of delays measured
+	long maxDelay; //largest delay measured, in frames
+};
+
+/*A structure for a log file that is rotated by size and age. The active segment always
+lives at path, so readers (such as getPreviousScore) find it without searching. Closed
+segments are renamed to path.N and compressed to path.N.gz in the background. Lines are
+gathered in buffer and written with plain write() calls, so logging (and rotating) never
+allocates memory
+*/
+struct logger
+{
+	char path[100]; //path of the active segment
+	int fd; //the open active segment
+	bool isOpen; //fd is valid (a zeroed logger isn't open)
+	char buffer[LOG_BUFFER_SIZE]; //lines that haven't been written to fd yet
+	long size; //bytes in the active segment
+	time_t openedAt; //when the active segment was started
+	int nextSeq; //sequence number the active segment gets when it is closed
+	long unflushed; //bytes waiting in buffer
+	long maxBytes;
+	int maxAge;
+	int maxSegments;
+	int flushBytes; //0 flushes every line
+	long bytesWritten; //total bytes logged, used to work out write amplification
+	long flushes; //total number of flushes
+	long rotations; //total number of segments closed
+};
+
 /*
  * Read an numeric param from the file and assign it to the integer param array (after converting from char to int)
  */
@@ -121,22 +278,24 @@ int getSizeOfPathStr(char* buffer, int *i)
 }
 
 /*
- * Read a file path parameter from the config file and assign it to the str param array
+ * Read a file path parameter from the config file and assign it to the str param array.
+ * Paths longer than MAX_PATH_LENGTH-1 characters are cut short
  */
-void readCharParam(char* buffer, char** storageStrArr, int* i, int* strInput)
+void readCharParam(char* buffer, char storageStrArr[][MAX_PATH_LENGTH], int* i, int* strInput)
 {
 	//get the string size
 	int size = getSizeOfPathStr(buffer, i);
 
 	int j = 0;
-	//alocate sufficient memory using the size
-	storageStrArr[*strInput] = (char*) calloc(size+1, sizeof(char));
 	for (j = 0; j < size; j++)
 	{
 		//copy the param over into the str param array (character by character)
-		storageStrArr[*strInput][j] = buffer[*i];
+		if (j < MAX_PATH_LENGTH - 1)
+			storageStrArr[*strInput][j] = buffer[*i];
 		(*i)++;
 	}
+	if (j > MAX_PATH_LENGTH - 1)
+		j = MAX_PATH_LENGTH - 1;
 
 	//Add a null terminator at the end
 	storageStrArr[*strInput][j] = '\0';
@@ -148,7 +307,7 @@ void readCharParam(char* buffer, char** storageStrArr, int* i, int* strInput)
 /*
  * Copies the copiedStr into the vesselStr character by character
  */
-void copyStr(char *vesselStr, char* copiedStr)
+void copyStr(char *vesselStr, const char* copiedStr)
 {
 	int i = 0;
 	//Copy the characters over until you reach the null terminator of the copied string
@@ -160,9 +319,6 @@ void copyStr(char *vesselStr, char* copiedStr)
 
 	//add a null terminator to the vessel string
 	vesselStr[i] = '\0';
-
-	//free the memory allocated to the copied string (in readCharParam)
-	free(copiedStr);
 }
 
 /*
@@ -190,14 +346,15 @@ void readConfig(FILE* configFile, char* logFileName, int* intervalTime, int* tim
 
 	//Arrays to store the int and str params
 	int intParamArr[3] = {0};
-	char* strParamArr[3] = {NULL};
+	char strParamArr[3][MAX_PATH_LENGTH] = {""};
 
 	//Loop until the end of the file
 	while(fgets(buffer, bufferSize, configFile) != NULL)
 	{
 		i = 0;
-		//Line isn't commented out
-		if(buffer[i] != '#')
+		//Line isn't commented out and there are still positional params to read
+		//(anything after them is an optional param for readOptions)
+		if(buffer[i] != '#' && strInput < maxStrParams)
 		{
 			//Line isn't empty
 			while(buffer[i] != 0)
@@ -242,6 +399,91 @@ void readConfig(FILE* configFile, char* logFileName, int* intervalTime, int* tim
 	copyStr(niceSoundPath, strParamArr[2]);
 }
 
+/*
+ * Reads the optional "NAME = value" params from the config file into opts. Options that
+ * are not in the file keep the defaults set here. The optional params must come after the
+ * six params read by readConfig
+ */
+void readOptions(FILE* configFile, struct options* opts)
+{
+	//Maximum amount of character per line
+	char buffer[500];
+	char name[50];
+	char value[100];
+
+	//Defaults: 1 MB segments, rotated at least weekly, 8 old segments kept
+	opts->logMaxBytes = 1024*1024;
+	opts->logMaxAge = 7*24*60*60;
+	opts->logMaxSegments = 8;
+	opts->logFlushBytes = 4096;
+
+	//Defaults: libao as before. For ALSA, 256 frame periods (about 6 ms) in a 4 period buffer
+	opts->audioBackend = AUDIO_LIBAO;
+	strcpy(opts->alsaDevice, "default");
+	opts->alsaPeriodFrames = 256;
+	opts->alsaBufferFrames = 1024;
+	opts->alsaMmap = 1;
+
+	//Default: practice mode off
+	opts->practiceSpeed = 100;
+
+	//Default: 64 MB, enough for a six minute backing track. Pages that are never used
+	//aren't given any memory by the kernel
+	opts->arenaBytes = 64*1024*1024;
+
+	//Defaults: resume a song interrupted in the last two minutes, from a checkpoint that
+	//survives the watchdog resetting the Pi
+	opts->resumeWindow = 120;
+	opts->checkpointSync = 1;
+
+	//Start again from the top of the file
+	rewind(configFile);
+
+	while(fgets(buffer, sizeof(buffer), configFile) != NULL)
+	{
+		//Skip comments and lines that aren't a name and a value
+		if(buffer[0] == '#' || sscanf(buffer, " %49[A-Z_] = %99s", name, value) != 2)
+			continue;
+
+		if (strcmp(name, "LOG_MAX_BYTES") == 0)
+			opts->logMaxBytes = atol(value);
+		else if (strcmp(name, "LOG_MAX_AGE") == 0)
+			opts->logMaxAge = atol(value);
+		else if (strcmp(name, "LOG_MAX_SEGMENTS") == 0)
+			opts->logMaxSegments = atol(value);
+		else if (strcmp(name, "LOG_FLUSH_BYTES") == 0)
+			opts->logFlushBytes = atol(value);
+		else if (strcmp(name, "AUDIO_BACKEND") == 0)
+			opts->audioBackend = (strcmp(value, "alsa") == 0) ? AUDIO_ALSA : AUDIO_LIBAO;
+		else if (strcmp(name, "ALSA_DEVICE") == 0)
+			snprintf(opts->alsaDevice, sizeof(opts->alsaDevice), "%.49s", value);
+		else if (strcmp(name, "ALSA_PERIOD_FRAMES") == 0)
+			opts->alsaPeriodFrames = atol(value);
+		else if (strcmp(name, "ALSA_BUFFER_FRAMES") == 0)
+			opts->alsaBufferFrames = atol(value);
+		else if (strcmp(name, "ALSA_MMAP") == 0)
+			opts->alsaMmap = atol(value);
+		else if (strcmp(name, "PRACTICE_SPEED") == 0)
+			opts->practiceSpeed = atol(value);
+		else if (strcmp(name, "ARENA_BYTES") == 0)
+			opts->arenaBytes = atol(value);
+		else if (strcmp(name, "RESUME_WINDOW") == 0)
+			opts->resumeWindow = atol(value);
+		else if (strcmp(name, "CHECKPOINT_SYNC") == 0)
+			opts->checkpointSync = atol(value);
+	}
+
+	//Practice mode goes from half to one and a half times normal speed
+	if (opts->practiceSpeed < 50)
+		opts->practiceSpeed = 50;
+	else if (opts->practiceSpeed > 150)
+		opts->practiceSpeed = 150;
+
+	//The arena always has room for the sound cues
+	if (opts->arenaBytes < 1024*1024)
+		opts->arenaBytes = 1024*1024;
+}
+
 /*This function will attempt to initalize a GPIO_Handle object which would allow us to read
 and write to the gpio pins on the pi. If unsuccesful the function relies on the watchdog 
 restaring the program. Otherwise the pins corresponding to the leds are set to output
@@ -288,7 +530,9 @@ GPIO_Handle initializePins (const struct ledPins LEDs)
 	sel_reg |= 1 << 11;
 	gpiolib_write_reg(gpio, GPFSEL(1), sel_reg);
 
+#ifndef GZ_MOCK_GPIO
 	system("gpio_alt -p 18 -f 5"); //use asystem command to set pin 18 to ALT5, PWM1 for audio output
+#endif
 
 	return gpio;
 
@@ -424,293 +668,2513 @@ bool checkButtons (const GPIO_Handle gpio, const int intervalCounter, const stru
 	return true;
 }
 
-void playSound (char* path) //plays specified sound sound
+/*Turns the first length rows of song into a compiledChart for the given pins, so that the
+game loop only has to look up and write whole register words. Interval k shows row k on
+the back LEDs and row k-1 on the front LEDs, like updateLEDs. Interval 0 leaves the front
+LEDs alone and interval length shows the back LEDs off
+*/
+void compileChart (struct compiledChart* chart, const struct row* song, const int length, const struct ledPins LEDs, const struct buttons butts)
 {
-	/*
-	function plays a mp3 file based on the filepath input
-	outputs nothing 
+	const uint32_t backPins[3] = {1u << LEDs.led21, 1u << LEDs.led22, 1u << LEDs.led23};
+	const uint32_t frontPins[3] = {1u << LEDs.led11, 1u << LEDs.led12, 1u << LEDs.led13};
+	const uint32_t buttonPins[3] = {1u << butts.b1, 1u << butts.b2, 1u << butts.b3};
+	const struct row blank = {0, 0, 0};
 
-	based on sample code provided by the libraries 
-	*/
-	mpg123_handle *mh;
-    unsigned char *buffer;
-    size_t buffer_size;
-    size_t done;
-    int err;
+	chart->length = length;
+	chart->care = buttonPins[0] | buttonPins[1] | buttonPins[2];
 
-    int driver;
-    ao_device *dev;
-
-    ao_sample_format format;
-    int channels, encoding;
-    long rate;
-
-    /* initializations */
-    ao_initialize();
-    driver = ao_default_driver_id();
-    mpg123_init();
-    mh = mpg123_new(NULL, &err);
-    buffer_size = mpg123_outblock(mh);
-    buffer = (unsigned char*) malloc(buffer_size * sizeof(unsigned char));
+	for (int k = 0; k <= length; k++)
+	{
+		const struct row* back = (k < length) ? &song[k] : &blank;
+		const int backStatus[3] = {back->status1, back->status2, back->status3};
+		struct rowMasks* masks = &chart->rows[k];
 
-    /* open the file and get the decoding format */
-    mpg123_open(mh, path);
-    mpg123_getformat(mh, &rate, &channels, &encoding);
+		masks->set = 0;
+		masks->clr = 0;
+		masks->expect = 0;
 
-    /* set the output format and open the output device */
-    format.bits = mpg123_encsize(encoding) * BITS;
-    format.rate = rate;
-    format.channels = channels;
-    format.byte_format = AO_FMT_NATIVE;
-    format.matrix = 0;
-    dev = ao_open_live(driver, &format, NULL);
+		for (int column = 0; column < 3; column++)
+		{
+			if (backStatus[column])
+				masks->set |= backPins[column];
+			else
+			{
+				masks->clr |= backPins[column];
+				//A button that shouldn't be pressed should read high
+				masks->expect |= buttonPins[column];
+			}
+		}
 
-    /* decode and play */
-    while (mpg123_read(mh, buffer, buffer_size, &done) == MPG123_OK)
-        ao_play(dev, buffer, done);
+		if (k > 0)
+		{
+			const int frontStatus[3] = {song[k-1].status1, song[k-1].status2, song[k-1].status3};
+			for (int column = 0; column < 3; column++)
+			{
+				if (frontStatus[column])
+					masks->set |= frontPins[column];
+				else
+					masks->clr |= frontPins[column];
+			}
+		}
+	}
+}
 
-    /* clean up */
-    free(buffer);
-    ao_close(dev);
-    mpg123_close(mh);
-    mpg123_delete(mh);
-    mpg123_exit();
-    ao_shutdown();
+/*The same as updateLEDs, but for a compiled chart: two register writes per interval
+*/
+void updateLEDsCompiled (const struct compiledChart* chart, const int intervalCounter, const GPIO_Handle gpio)
+{
+	const struct rowMasks* masks = &chart->rows[intervalCounter];
+	gpiolib_write_reg(gpio, GPSET(0), masks->set);
+	gpiolib_write_reg(gpio, GPCLR(0), masks->clr);
+}
 
+/*The same as checkButtons, but for a compiled chart: one register read and a compare
+*/
+bool checkButtonsCompiled (const struct compiledChart* chart, const int intervalCounter, const GPIO_Handle gpio)
+{
+	uint32_t lvl_reg = gpiolib_read_reg(gpio, GPLEV(0));
+	return ((lvl_reg ^ chart->rows[intervalCounter].expect) & chart->care) == 0;
 }
 
-/*This is a help function that sets the states of all of the LEDs to on
+/*Sets up an arena of size bytes. Returns false if the memory couldn't be allocated
 */
-void setAllOn (const GPIO_Handle gpio, const struct ledPins LEDs)
+bool arenaInit (struct arena* arena, const size_t size)
 {
-	outputOn (gpio, LEDs.led11);
-	outputOn (gpio, LEDs.led12);
-	outputOn (gpio, LEDs.led13);
-	outputOn (gpio, LEDs.led21);
-	outputOn (gpio, LEDs.led22);
-	outputOn (gpio, LEDs.led23);
+	arena->base = (unsigned char*) malloc(size);
+	arena->size = arena->base ? size : 0;
+	arena->used = 0;
+	arena->peak = 0;
+	pthread_mutex_init(&arena->lock, NULL);
+	return arena->base != NULL;
 }
 
-/*This is a helper fucntiont hat sets the state of all LEDs to off
+/*Returns size bytes from the arena, aligned to a cache line so SIMD loads of it are fast.
+Returns NULL if there isn't enough room left
 */
-void setAllOff (const GPIO_Handle gpio, const struct ledPins LEDs)
+void* arenaAlloc (struct arena* arena, const size_t size)
 {
-	outputOff (gpio, LEDs.led11);
-	outputOff (gpio, LEDs.led12);
-	outputOff (gpio, LEDs.led13);
-	outputOff (gpio, LEDs.led21);
-	outputOff (gpio, LEDs.led22);
-	outputOff (gpio, LEDs.led23);	
+	void* block = NULL;
+	size_t start;
+
+	pthread_mutex_lock(&arena->lock);
+	start = (arena->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+	if (start <= arena->size && size <= arena->size - start)
+	{
+		block = arena->base + start;
+		arena->used = start + size;
+		if (arena->used > arena->peak)
+			arena->peak = arena->used;
+	}
+	pthread_mutex_unlock(&arena->lock);
+	return block;
 }
 
-/* THis function flashes all of the LEDs to indicate to the user that the
-song has finished
+/*Returns a mark that arenaReset can later go back to
 */
-void finishedSong (const GPIO_Handle gpio, const struct ledPins LEDs)
+size_t arenaMark (struct arena* arena)
 {
-	printf("Song is finished. Restarting in 10 seconds\n");
-	fflush(stdout);
+	size_t mark;
 
-	setAllOn (gpio, LEDs);
-	usleep (1000000);
-	setAllOff (gpio, LEDs);
-	usleep (1000000);
-	setAllOn (gpio, LEDs);
-	usleep (1000000);
-	setAllOff (gpio, LEDs);
-	usleep(1000000);
-	setAllOn (gpio, LEDs);
-	usleep (1000000);
-	setAllOff (gpio, LEDs);
-	usleep (1000000);
-	setAllOn (gpio, LEDs);
-	usleep (1000000);
-	setAllOff (gpio, LEDs);
+	pthread_mutex_lock(&arena->lock);
+	mark = arena->used;
+	pthread_mutex_unlock(&arena->lock);
+	return mark;
 }
 
-//This function will get the current time using the gettimeofday function
-void getTime(char* buffer)
+/*Gives back everything allocated since mark was taken
+*/
+void arenaReset (struct arena* arena, const size_t mark)
 {
-	//Create a timeval struct named tv
-  	struct timeval tv;
+	pthread_mutex_lock(&arena->lock);
+	arena->used = mark;
+	pthread_mutex_unlock(&arena->lock);
+}
 
-	//Create a time_t variable named curtime
-  	time_t curtime;
+/*Frees the arena's memory. Nothing allocated from it may be used afterwards
+*/
+void arenaFree (struct arena* arena)
+{
+	free(arena->base);
+	arena->base = NULL;
+	arena->size = arena->used = 0;
+	pthread_mutex_destroy(&arena->lock);
+}
 
+/*Returns a new mp3 decoder that only outputs the cue format, or NULL if it couldn't be made.
+One decoder can be used for any number of files, one after the other
+*/
+mpg123_handle* newDecoder (void)
+{
+	int err;
+	mpg123_handle* mh = mpg123_new(NULL, &err);
 
-	//Get the current time and store it in the tv struct
-  	gettimeofday(&tv, NULL); 
+	if (!mh)
+		return NULL;
 
-	//Set curtime to be equal to the number of seconds in tv
-  	curtime=tv.tv_sec;
+	/* only allow the one output format, mpg123 resamples and remixes to it */
+	mpg123_format_none(mh);
+	mpg123_format(mh, CUE_RATE, CUE_CHANNELS, MPG123_ENC_SIGNED_16);
 
-	//This will set buffer to be equal to a string that in
-	//equivalent to the current date, in a month, day, year and
-	//the current time in 24 hour notation.
-  	strftime(buffer,30,"%m-%d-%Y  %T.",localtime(&curtime));
+	/* ID3v2 tags would be copied into memory mpg123 allocates, and they aren't needed */
+	mpg123_param(mh, MPG123_ADD_FLAGS, MPG123_SKIP_ID3V2, 0);
+	return mh;
 }
 
-/*
- * Return the most recent score in the score log file
- */
-int getPreviousScore(char* scoreFileName)
+/*Decodes the mp3 file at path into cue with the decoder mh, so it can be played later
+without touching the file or the decoder. Every cue is converted to the same CUE_RATE,
+CUE_CHANNELS, 16 bit format so the audio device can be opened before any cue is decoded.
+The file is scanned first so its exact length is known, and the samples are decoded
+straight into a block of that size from arena. Returns false if the file could not be
+decoded to the end or the arena is full (the block isn't given back until the arena is reset)
+
+based on sample code provided by the libraries
+*/
+bool decodeSoundWith (mpg123_handle* mh, const char* path, struct soundCue* cue, struct arena* arena)
 {
-	FILE *scoreFile;
-	//Length of the score, leading zeroes and null character included
-	const int scoreLength = 2 + 1;
+	size_t done;
+	size_t capacity;
+	off_t length;
+	int err = MPG123_ERR;
 
-	//Int variable that holds the previous score: it's the return value
-	int score = 0;
+	cue->pcm = NULL;
+	cue->size = 0;
 
-	//Index to loop through the previous score in the file
-	int i = 0;
+	if (mpg123_open(mh, path) != MPG123_OK)
+		return false;
 
-	//Open the score file in read mode
-	scoreFile = fopen(scoreFileName, "r");
-	//Direct the file pointer to the first leading 0
-	fseek(scoreFile, -scoreLength - 1, SEEK_END); 
-	//File exists
-	if (scoreFile) 
+	/* scanning reads every frame header, so the length is exact rather than estimated */
+	mpg123_scan(mh);
+	length = mpg123_length(mh);
+
+	/* one mp3 frame of slack for rounding in the resampler */
+	capacity = (length + 1152) * CUE_FRAME_BYTES;
+	if (length > 0)
+		cue->pcm = (unsigned char*) arenaAlloc(arena, capacity);
+
+	while (cue->pcm && cue->size < capacity)
 	{
-		//loop 2 times only
-		while (i < 2)
-		{
-			//Convert score from char to int
-			score = (score*10) + (getc(scoreFile) - '0');
-			i++;
-		}
-		//close the score file
-		fclose(scoreFile);
+		err = mpg123_read(mh, cue->pcm + cue->size, capacity - cue->size, &done);
+		cue->size += done;
+		if (err != MPG123_OK && err != MPG123_NEW_FORMAT)
+			break;
 	}
 
-	//return the previous score
-	return score;
+	mpg123_close(mh);
+
+	/* a cue that didn't decode to the end isn't kept */
+	if (err != MPG123_DONE)
+	{
+		cue->pcm = NULL;
+		cue->size = 0;
+		return false;
+	}
+	return true;
 }
 
-/*
- * Assigns a song with a set difficulty for the user to play based on their most recent score in the score log
- */
-void assignSong (struct row* const song, char* scoreFileName, const int MAX_INTERVALS)
+/*This function decodes the mp3 at path into cue, with a decoder of its own. It is used at
+startup, where each cue is decoded on its own thread
+*/
+bool decodeSound (const char* path, struct soundCue* cue, struct arena* arena)
 {
-	//Get the most recent score
-	int score = getPreviousScore(scoreFileName);
-
-	//Establish 2 thresholds as a percentage of the max interval
-	const int threshold1 = MAX_INTERVALS/3;
-	const int threshold2 = 2*threshold1;
+	mpg123_handle* mh = newDecoder();
+	bool ok;
 
-	FILE* songFile;
+	if (!mh)
+		return false;
+	ok = decodeSoundWith(mh, path, cue, arena);
+	mpg123_delete(mh);
+	return ok;
+}
 
-	//Output previous score for user to see
-	printf("Previous Score: %d\n", score);
+/*Opens the ALSA PCM from the config in the cue format, with the requested period and
+buffer size. mmap transfers are used when asked for and the device supports them.
+Returns false if the device couldn't be set up
+*/
+static bool alsaOpen (struct audioOutput* out, const struct options* opts)
+{
+	snd_pcm_hw_params_t* hw;
+	snd_pcm_sw_params_t* sw;
+	int err;
 
-	//If the score is below 33% of the MAX_INTERVAL size, select the easy song
-	if (score < threshold1)
-	{
-		printf("Currently Playing: Easy Song\n");
-		fflush(stdout);
-		songFile = fopen("/home/pi/easySong.log", "r");
-	}
-	//Score is above 33% and below 66%, select the medium song
-	else if (score >= threshold1 && score < threshold2)
+	if ((err = snd_pcm_open(&out->pcm, opts->alsaDevice, SND_PCM_STREAM_PLAYBACK, 0)) < 0)
 	{
-		printf("Currently Playing: Medium Song\n");
-		fflush(stdout);
-		songFile = fopen("/home/pi/medSong.log", "r");
+		fprintf(stderr, "ALSA device %s could not be opened: %s\n", opts->alsaDevice, snd_strerror(err));
+		out->pcm = NULL;
+		return false;
 	}
-	//Score is above 66%, select the hard song
-	else
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(out->pcm, hw);
+
+	//Fall back to plain writes if the device can't do mmap
+	out->mmap = opts->alsaMmap && snd_pcm_hw_params_set_access(out->pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0;
+	if (!out->mmap)
+		snd_pcm_hw_params_set_access(out->pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED);
+
+	out->periodFrames = opts->alsaPeriodFrames;
+	out->bufferFrames = opts->alsaBufferFrames;
+	if ((err = snd_pcm_hw_params_set_format(out->pcm, hw, SND_PCM_FORMAT_S16)) < 0 ||
+		(err = snd_pcm_hw_params_set_channels(out->pcm, hw, CUE_CHANNELS)) < 0 ||
+		(err = snd_pcm_hw_params_set_rate(out->pcm, hw, CUE_RATE, 0)) < 0 ||
+		(err = snd_pcm_hw_params_set_period_size_near(out->pcm, hw, &out->periodFrames, NULL)) < 0 ||
+		(err = snd_pcm_hw_params_set_buffer_size_near(out->pcm, hw, &out->bufferFrames)) < 0 ||
+		(err = snd_pcm_hw_params(out->pcm, hw)) < 0)
 	{
-		printf("Currently Playing: Hard Song\n");
-		fflush(stdout);
-		songFile = fopen("/home/pi/hardSong.log", "r");
+		fprintf(stderr, "ALSA device %s does not support the cue format: %s\n", opts->alsaDevice, snd_strerror(err));
+		snd_pcm_close(out->pcm);
+		out->pcm = NULL;
+		return false;
 	}
 
-	int i = 0;
+	//The device may have picked different sizes than we asked for
+	snd_pcm_hw_params_get_period_size(hw, &out->periodFrames, NULL);
+	snd_pcm_hw_params_get_buffer_size(hw, &out->bufferFrames);
 
-	//Number of character per line in the song files
-	int bufferSize = 7;
+	//Start as soon as one period is queued, and wake up whenever a period is free
+	snd_pcm_sw_params_alloca(&sw);
+	snd_pcm_sw_params_current(out->pcm, sw);
+	snd_pcm_sw_params_set_start_threshold(out->pcm, sw, out->periodFrames);
+	snd_pcm_sw_params_set_avail_min(out->pcm, sw, out->periodFrames);
+	snd_pcm_sw_params(out->pcm, sw);
 
-	//Char array to hold each line
-	char buffer[bufferSize];
+	snd_pcm_prepare(out->pcm);
+	return true;
+}
 
-	//counts the number of intervals
-	int intervalCount = 0;
+/*Gets the device going again after an error. Underruns are counted. Returns false if the
+device couldn't be recovered
+*/
+static bool alsaRecover (struct audioOutput* out, const int err)
+{
+	if (err == -EPIPE)
+		out->xruns++;
+	return snd_pcm_recover(out->pcm, err, 1) == 0;
+}
 
-	//holds the desired statuses of the buttons as seen in the song
-	int statusArr[3] = {0};
+/*Records how far behind the write position the sound being heard is
+*/
+static void alsaMeasureDelay (struct audioOutput* out)
+{
+	snd_pcm_sframes_t delay;
 
-	//Current interval is less than the max interval and the buffer is not at the end of the file
-	for (intervalCount = 0; (intervalCount < MAX_INTERVALS && fgets(buffer, bufferSize, songFile) != NULL); intervalCount++)
+	if (snd_pcm_state(out->pcm) == SND_PCM_STATE_RUNNING && snd_pcm_delay(out->pcm, &delay) == 0)
 	{
-		i = 0;
-		for (int j = 0; j < 6; j += 2)
-		{
-			//Assign the statuses to the status array
-			statusArr[i] = buffer[j] - '0';
-			i++;		
-		}
-		
-		//Assign the statuses to the status fields in the row struct (which is in an array for row structs)
-		song[intervalCount] = (struct row) {.status1 = statusArr[0], .status2 = statusArr[1], .status3 = statusArr[2]};
+		out->delaySum += delay;
+		out->delaySamples++;
+		if (delay > out->maxDelay)
+			out->maxDelay = delay;
 	}
 }
 
-/*
- * Update the score log file with the new score
- */
-void updateScore (char* scoreFileName, const int score, const char* programName, char* time) //update the log file
+/*Copies frames straight into the ALSA ring buffer, a period or less at a time
+*/
+static void alsaPlayMmap (struct audioOutput* out, const unsigned char* pcm, const snd_pcm_uframes_t frames)
 {
-	//Check if the score is invalid
-	if (score < 0 || score > 30)
-	{
-		//Warn the user and exit the function
-		perror("Invalid Score");
-		return;
-	}
+	const snd_pcm_channel_area_t* areas;
+	snd_pcm_uframes_t offset, chunk;
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_sframes_t avail, committed;
+	int err;
 
-	//Number of digits
-	int n = log10(score) + 1;
-	//Hold a temp score for to convert from int to str
-	int tempScore = score;
-	//Holds the str of the score
-	char scoreStr[3];
-	//Add a null terminator
-	scoreStr[2] = '\0';
-	for (int i = 1; i >= 0; i--)
+	while (done < frames)
 	{
-		//If the current index is outside the number of digits (leading 0s), put a '0' char in front
-		if (i < 2 - n)
+		avail = snd_pcm_avail_update(out->pcm);
+		if (avail < 0)
 		{
-			scoreStr[i] = '0';
+			if (!alsaRecover(out, avail))
+				return;
+			continue;
 		}
-		//Current index is inside the number of digits (actual score value)
-		else
+
+		//Wait for a free period, unless what is left fits already
+		if ((snd_pcm_uframes_t) avail < out->periodFrames && (snd_pcm_uframes_t) avail < frames - done)
 		{
-			//Assign the digit to the score str
-			scoreStr[i] = tempScore % 10 + '0';
-			//Divide by 10 (integer division: no decimals), to get the next digit
-			tempScore /= 10;
+			//The buffer is full but the device hasn't started yet
+			if (snd_pcm_state(out->pcm) == SND_PCM_STATE_PREPARED)
+				snd_pcm_start(out->pcm);
+			if ((err = snd_pcm_wait(out->pcm, 1000)) < 0 && !alsaRecover(out, err))
+				return;
+			continue;
+		}
+
+		chunk = frames - done;
+		if ((err = snd_pcm_mmap_begin(out->pcm, &areas, &offset, &chunk)) < 0)
+		{
+			if (!alsaRecover(out, err))
+				return;
+			continue;
+		}
+
+		//The cue is interleaved like the buffer, so a chunk is one copy
+		memcpy((unsigned char*) areas[0].addr + (areas[0].first + offset * areas[0].step) / 8,
+			pcm + done * CUE_FRAME_BYTES, chunk * CUE_FRAME_BYTES);
+
+		committed = snd_pcm_mmap_commit(out->pcm, offset, chunk);
+		if (committed < 0 || (snd_pcm_uframes_t) committed != chunk)
+		{
+			if (!alsaRecover(out, committed < 0 ? committed : -EPIPE))
+				return;
+			continue;
 		}
+		done += chunk;
+
+		//mmap writes don't start the device by themselves
+		if (snd_pcm_state(out->pcm) == SND_PCM_STATE_PREPARED && done >= out->periodFrames)
+			snd_pcm_start(out->pcm);
+		alsaMeasureDelay(out);
 	}
-	//Open the score file
-	FILE* scoreFile;
-	scoreFile = fopen("/home/pi/score.log", "a");
-	//Log the score to the score log file
-	PRINT_MSG(scoreFile, time, programName, scoreStr);
-	//Close the score log file
-	fclose(scoreFile);
 }
 
-int main (const int argc, const char* const argv[])
+/*Writes frames to ALSA with snd_pcm_writei, which blocks while the buffer is full
+*/
+static void alsaPlayWrite (struct audioOutput* out, const unsigned char* pcm, const snd_pcm_uframes_t frames)
 {
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_sframes_t written;
 
-	//Create a string that contains the program name
-	const char* argName = argv[0];
+	while (done < frames)
+	{
+		written = snd_pcm_writei(out->pcm, pcm + done * CUE_FRAME_BYTES, frames - done);
+		if (written < 0)
+		{
+			if (!alsaRecover(out, written))
+				return;
+			continue;
+		}
+		done += written;
+		alsaMeasureDelay(out);
+	}
+}
 
-	//These variables will be used to count how long the name of the program is
-	int i = 0;
-	int namelength = 0;
+/*libao keeps one driver list for the whole process, and ao_shutdown() frees it from under
+every device that is still open (practice mode has two). So it is initialized once, when the
+first libao device is opened, and shut down once by audioShutdown() when the program exits
+*/
+static pthread_once_t aoOnce = PTHREAD_ONCE_INIT;
+static bool aoStarted = false;
+
+static void aoStart(void)
+{
+	ao_initialize();
+	aoStarted = true;
+}
+
+/*Opens the audio output chosen in the config. Returns false if it couldn't be opened
+*/
+bool audioOpen (struct audioOutput* out, const struct options* opts)
+{
+	ao_sample_format format;
+
+	memset(out, 0, sizeof(*out));
+	out->backend = opts->audioBackend;
+
+	if (out->backend == AUDIO_ALSA)
+		return alsaOpen(out, opts);
+
+	pthread_once(&aoOnce, aoStart);
+	format.bits = 16;
+	format.rate = CUE_RATE;
+	format.channels = CUE_CHANNELS;
+	format.byte_format = AO_FMT_NATIVE;
+	format.matrix = 0;
+	out->ao = ao_open_live(ao_default_driver_id(), &format, NULL);
+	return out->ao != NULL;
+}
+
+/*Hands size bytes of cue format samples to the audio output, returns once they have all
+been taken by the device
+*/
+void audioWrite (struct audioOutput* out, const unsigned char* pcm, const size_t size)
+{
+	if (out->ao)
+		ao_play(out->ao, (char*) pcm, size);
+	else if (out->pcm && out->mmap)
+		alsaPlayMmap(out, pcm, size / CUE_FRAME_BYTES);
+	else if (out->pcm)
+		alsaPlayWrite(out, pcm, size / CUE_FRAME_BYTES);
+}
+
+/*Plays a decoded sound cue, returns once it has all been handed to the device. With ALSA
+it also waits for it to finish, so the next cue starts from an empty buffer instead of
+counting the silence in between as an underrun
+*/
+void playCue (struct audioOutput* out, const struct soundCue* cue)
+{
+	if (!cue->pcm)
+		return;
+
+	audioWrite(out, cue->pcm, cue->size);
+	if (out->pcm)
+	{
+		snd_pcm_drain(out->pcm);
+		snd_pcm_prepare(out->pcm);
+	}
+}
+
+/*Throws away whatever is still waiting to be played, so the output starts again from
+silence. libao can't do that, so there the rest just plays out
+*/
+void audioDrop (struct audioOutput* out)
+{
+	if (out->pcm)
+	{
+		snd_pcm_drop(out->pcm);
+		snd_pcm_prepare(out->pcm);
+	}
+}
+
+/*Writes a one line summary of the output latency and underruns into line
+*/
+void audioStats (const struct audioOutput* out, char* line, const size_t size)
+{
+	if (out->pcm)
+		snprintf(line, size, "ALSA latency %.2f ms average, %.2f ms max (period %lu, buffer %lu frames, %s), %ld xruns",
+			out->delaySamples ? out->delaySum / out->delaySamples * 1000 / CUE_RATE : 0.0,
+			out->maxDelay * 1000.0 / CUE_RATE, (unsigned long) out->periodFrames, (unsigned long) out->bufferFrames,
+			out->mmap ? "mmap" : "writei", out->xruns);
+	else
+		snprintf(line, size, "libao output, latency not measured");
+}
+
+/*Closes the audio output
+*/
+void audioClose (struct audioOutput* out)
+{
+	if (out->pcm)
+		snd_pcm_close(out->pcm);
+	if (out->ao)
+		ao_close(out->ao);
+	out->pcm = NULL;
+	out->ao = NULL;
+}
+
+/*Shuts libao down, once every output has been closed and the program is about to exit
+*/
+void audioShutdown (void)
+{
+	if (aoStarted)
+		ao_shutdown();
+	aoStarted = false;
+}
+
+/*A structure for a WSOLA (waveform similarity overlap-add) time stretcher working through
+a decoded track. Each step takes a window of the input near the position the speed says
+we should be at, moved by up to STRETCH_TOLERANCE frames so it lines up best with what
+came before, and overlap-adds it into the output. The pitch doesn't change
+*/
+struct stretcher
+{
+	const short* input; //the track, interleaved stereo
+	long frames; //frames in the track
+	double hop; //input frames per output hop: STRETCH_HOP times the speed
+	double position; //where the next window should start in the input, in frames
+	long previous; //where the last window actually started
+	bool first;
+	float* window; //the Hann window, one value per sample (so twice per frame)
+	float* overlap; //output being built up, STRETCH_WINDOW frames of stereo
+	float* segment; //the chosen window of input as floats
+	float* reference; //mono: what would naturally have followed the last window
+	float* search; //mono: the input around the nominal position
+};
+
+//Four floats that the compiler keeps in one SIMD register (NEON on the Pi, SSE on x86)
+typedef float floatx4 __attribute__((vector_size(16)));
+
+/*Loads four floats from a pointer that doesn't have to be aligned
+*/
+static inline floatx4 loadFloatx4 (const float* p)
+{
+	floatx4 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*Returns the sum of a[i]*b[i] for i below n. n must be a multiple of 8
+*/
+static float dotProduct (const float* a, const float* b, const int n)
+{
+	floatx4 sum0 = {0, 0, 0, 0};
+	floatx4 sum1 = {0, 0, 0, 0};
+
+	//Two accumulators so consecutive multiply-adds don't wait on each other
+	for (int i = 0; i < n; i += 8)
+	{
+		sum0 += loadFloatx4(a + i) * loadFloatx4(b + i);
+		sum1 += loadFloatx4(a + i + 4) * loadFloatx4(b + i + 4);
+	}
+	sum0 += sum1;
+	return sum0[0] + sum0[1] + sum0[2] + sum0[3];
+}
+
+/*Adds in[i]*window[i] to out[i] for i below n. n must be a multiple of 4
+*/
+static void overlapAdd (float* out, const float* in, const float* window, const int n)
+{
+	for (int i = 0; i < n; i += 4)
+	{
+		floatx4 sum = loadFloatx4(out + i) + loadFloatx4(in + i) * loadFloatx4(window + i);
+		memcpy(out + i, &sum, sizeof(sum));
+	}
+}
+
+/*Writes the mono mix of count frames of the track starting at frame start into mono
+*/
+static void mixToMono (const short* input, const long start, const int count, float* mono)
+{
+	const short* frame = input + start * CUE_CHANNELS;
+	for (int i = 0; i < count; i++)
+		mono[i] = (frame[2*i] + frame[2*i + 1]) * (0.5f / 32768);
+}
+
+/*Returns the start of the window within STRETCH_TOLERANCE frames of nominal that best
+matches the reference, using the normalised cross-correlation over the overlap
+*/
+static long bestMatch (struct stretcher* st, const long nominal)
+{
+	const int length = STRETCH_WINDOW - STRETCH_HOP; //frames that overlap the last window
+	const long low = (nominal - STRETCH_TOLERANCE > 0) ? nominal - STRETCH_TOLERANCE : 0;
+	const long high = (nominal + STRETCH_TOLERANCE < st->frames - STRETCH_WINDOW) ? nominal + STRETCH_TOLERANCE : st->frames - STRETCH_WINDOW;
+	const int candidates = high - low + 1;
+	long best = nominal;
+	float bestScore = -1e30f;
+	float energy;
+
+	mixToMono(st->input, st->previous + STRETCH_HOP, length, st->reference);
+	mixToMono(st->input, low, candidates + length, st->search);
+
+	//The energy of each candidate is kept up to date as it slides instead of recomputed
+	energy = dotProduct(st->search, st->search, length);
+	for (int offset = 0; offset < candidates; offset++)
+	{
+		float score = dotProduct(st->reference, st->search + offset, length) / sqrtf(energy + 1e-9f);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = low + offset;
+		}
+		energy += st->search[offset + length] * st->search[offset + length] - st->search[offset] * st->search[offset];
+	}
+	return best;
+}
+
+/*Sets up a stretcher that plays track at speed (0.5 is half speed), with its buffers taken
+from arena. Returns false if the arena didn't have room for them
+*/
+bool stretchInit (struct stretcher* st, const struct soundCue* track, const double speed, struct arena* arena)
+{
+	const int samples = STRETCH_WINDOW * CUE_CHANNELS;
+
+	st->input = (const short*) track->pcm;
+	st->frames = track->size / CUE_FRAME_BYTES;
+	st->hop = STRETCH_HOP * speed;
+	st->position = 0;
+	st->previous = 0;
+	st->first = true;
+
+	st->window = (float*) arenaAlloc(arena, samples * sizeof(float));
+	st->overlap = (float*) arenaAlloc(arena, samples * sizeof(float));
+	st->segment = (float*) arenaAlloc(arena, samples * sizeof(float));
+	st->reference = (float*) arenaAlloc(arena, STRETCH_WINDOW * sizeof(float));
+	st->search = (float*) arenaAlloc(arena, (2*STRETCH_TOLERANCE + STRETCH_WINDOW) * sizeof(float));
+	if (!st->window || !st->overlap || !st->segment || !st->reference || !st->search)
+		return false;
+	memset(st->overlap, 0, samples * sizeof(float));
+
+	//A periodic Hann window, so windows a hop apart add up to exactly 1
+	for (int i = 0; i < STRETCH_WINDOW; i++)
+	{
+		float w = 0.5f - 0.5f * cosf(2 * M_PI * i / STRETCH_WINDOW);
+		st->window[2*i] = w;
+		st->window[2*i + 1] = w;
+	}
+	return true;
+}
+
+/*Produces the next STRETCH_HOP frames of stretched audio into out. Returns the number of
+frames produced, which is 0 once the end of the track has been reached
+*/
+int stretchStep (struct stretcher* st, short* out)
+{
+	const int samples = STRETCH_WINDOW * CUE_CHANNELS;
+	const int hopSamples = STRETCH_HOP * CUE_CHANNELS;
+	const long nominal = (long) st->position;
+	const short* frame;
+	long start;
+
+	if (nominal + STRETCH_WINDOW >= st->frames)
+		return 0;
+
+	start = st->first ? nominal : bestMatch(st, nominal);
+	st->first = false;
+	st->previous = start;
+	st->position += st->hop;
+
+	//Overlap-add the chosen window
+	frame = st->input + start * CUE_CHANNELS;
+	for (int i = 0; i < samples; i++)
+		st->segment[i] = frame[i];
+	overlapAdd(st->overlap, st->segment, st->window, samples);
+
+	//The first hop is now complete, send it out and slide the rest down
+	for (int i = 0; i < hopSamples; i++)
+	{
+		float sample = st->overlap[i];
+		out[i] = (sample > 32767) ? 32767 : (sample < -32768) ? -32768 : (short) sample;
+	}
+	memmove(st->overlap, st->overlap + hopSamples, (samples - hopSamples) * sizeof(float));
+	memset(st->overlap + samples - hopSamples, 0, hopSamples * sizeof(float));
+
+	return STRETCH_HOP;
+}
+
+/*A structure for the backing track of practice mode, which is stretched and played on its
+own thread (and its own audio output) while the game runs. The output and the decoder are
+set up once by backingOpen and kept for every song, and each song's track and stretcher
+buffers come from the session arena and are given back when the track stops
+*/
+struct backingTrack
+{
+	struct soundCue track;
+	struct stretcher stretch;
+	struct audioOutput out;
+	mpg123_handle* decoder;
+	struct arena* arena;
+	size_t mark; //what the arena goes back to when the track stops
+	pthread_t thread;
+	volatile bool stop; //set by the game loop to end the track early
+	bool ready; //the output and decoder are open
+	bool prepared; //a track is decoded and waiting to be played
+	bool playing;
+};
+
+/*The backing track thread: stretches the track a few hops at a time and plays it
+*/
+static void* backingThread (void* arg)
+{
+	struct backingTrack* bt = (struct backingTrack*) arg;
+	short chunk[4 * STRETCH_HOP * CUE_CHANNELS];
+	int frames;
+
+	while (!bt->stop)
+	{
+		frames = 0;
+		for (int hop = 0; hop < 4; hop++)
+			frames += stretchStep(&bt->stretch, chunk + frames * CUE_CHANNELS);
+		if (frames == 0)
+			break;
+		audioWrite(&bt->out, (unsigned char*) chunk, frames * CUE_FRAME_BYTES);
+	}
+	return NULL;
+}
+
+/*Opens the backing track's audio output and decoder, which take memory that shouldn't be
+allocated in the middle of a session. Returns false if either couldn't be opened
+*/
+bool backingOpen (struct backingTrack* bt, struct arena* arena, const struct options* opts)
+{
+	bt->arena = arena;
+	bt->prepared = false;
+	bt->playing = false;
+	bt->ready = false;
+
+	bt->decoder = newDecoder();
+	if (!bt->decoder)
+		return false;
+	if (!audioOpen(&bt->out, opts))
+	{
+		mpg123_delete(bt->decoder);
+		bt->decoder = NULL;
+		return false;
+	}
+	bt->ready = true;
+	return true;
+}
+
+/*Decodes the mp3 at path and gets it ready to play at speed percent of normal, startMs into
+the track (a resumed song doesn't start from the top). Decoding the whole song takes a while,
+so it is done before the song's clock starts, while the game waits for a button. Returns
+false if any part of that failed
+*/
+bool prepareBackingTrack (struct backingTrack* bt, const char* path, const int speed, const long long startMs)
+{
+	bt->prepared = false;
+	bt->playing = false;
+	bt->stop = false;
+	if (!bt->ready)
+		return false;
+
+	bt->mark = arenaMark(bt->arena);
+	if (!decodeSoundWith(bt->decoder, path, &bt->track, bt->arena) ||
+		!stretchInit(&bt->stretch, &bt->track, speed / 100.0, bt->arena))
+	{
+		arenaReset(bt->arena, bt->mark);
+		return false;
+	}
+
+	//The stretcher starts from wherever position is, in input frames
+	bt->stretch.position = startMs * CUE_RATE / 1000.0;
+	bt->prepared = true;
+	return true;
+}
+
+/*Starts playing the prepared track. It only starts a thread, so it can be called at the
+moment the song's clock starts. Returns false if there was nothing to play
+*/
+bool playBackingTrack (struct backingTrack* bt)
+{
+	if (!bt->prepared)
+		return false;
+	if (pthread_create(&bt->thread, NULL, backingThread, bt) != 0)
+	{
+		arenaReset(bt->arena, bt->mark);
+		bt->prepared = false;
+		return false;
+	}
+	bt->playing = true;
+	return true;
+}
+
+/*Stops the backing track if it is still playing (or never started) and gives its memory back
+to the arena
+*/
+void stopBackingTrack (struct backingTrack* bt)
+{
+	if (bt->playing)
+	{
+		bt->stop = true;
+		pthread_join(bt->thread, NULL);
+		audioDrop(&bt->out);
+	}
+	if (bt->playing || bt->prepared)
+		arenaReset(bt->arena, bt->mark);
+	bt->prepared = false;
+	bt->playing = false;
+}
+
+/*Closes the backing track's output and decoder
+*/
+void backingClose (struct backingTrack* bt)
+{
+	stopBackingTrack(bt);
+	if (!bt->ready)
+		return;
+	audioClose(&bt->out);
+	mpg123_delete(bt->decoder);
+	bt->decoder = NULL;
+	bt->ready = false;
+}
+
+/*This is a help function that sets the states of all of the LEDs to on
+*/
+void setAllOn (const GPIO_Handle gpio, const struct ledPins LEDs)
+{
+	outputOn (gpio, LEDs.led11);
+	outputOn (gpio, LEDs.led12);
+	outputOn (gpio, LEDs.led13);
+	outputOn (gpio, LEDs.led21);
+	outputOn (gpio, LEDs.led22);
+	outputOn (gpio, LEDs.led23);
+}
+
+/*This is a helper fucntiont hat sets the state of all LEDs to off
+*/
+void setAllOff (const GPIO_Handle gpio, const struct ledPins LEDs)
+{
+	outputOff (gpio, LEDs.led11);
+	outputOff (gpio, LEDs.led12);
+	outputOff (gpio, LEDs.led13);
+	outputOff (gpio, LEDs.led21);
+	outputOff (gpio, LEDs.led22);
+	outputOff (gpio, LEDs.led23);	
+}
+
+/* THis function flashes all of the LEDs to indicate to the user that the
+song has finished
+*/
+void finishedSong (const GPIO_Handle gpio, const struct ledPins LEDs)
+{
+	printf("Song is finished. Restarting in 10 seconds\n");
+	fflush(stdout);
+
+	setAllOn (gpio, LEDs);
+	usleep (1000000);
+	setAllOff (gpio, LEDs);
+	usleep (1000000);
+	setAllOn (gpio, LEDs);
+	usleep (1000000);
+	setAllOff (gpio, LEDs);
+	usleep(1000000);
+	setAllOn (gpio, LEDs);
+	usleep (1000000);
+	setAllOff (gpio, LEDs);
+	usleep (1000000);
+	setAllOn (gpio, LEDs);
+	usleep (1000000);
+	setAllOff (gpio, LEDs);
+}
+
+//This function will get the current time using the gettimeofday function
+void getTime(char* buffer)
+{
+	//Create a timeval struct named tv
+  	struct timeval tv;
+
+	//Create a time_t variable named curtime
+  	time_t curtime;
+
+
+	//Get the current time and store it in the tv struct
+  	gettimeofday(&tv, NULL); 
+
+	//Set curtime to be equal to the number of seconds in tv
+  	curtime=tv.tv_sec;
+
+	//Break the time down in the local time zone. localtime_r() is used because
+	//localtime() looks at the TZ variable again on every call, and copies it
+	//(allocating memory) when TZ isn't set
+	struct tm local;
+	localtime_r(&curtime, &local);
+
+	//This will set buffer to be equal to a string that in
+	//equivalent to the current date, in a month, day, year and
+	//the current time in 24 hour notation.
+  	strftime(buffer,30,"%m-%d-%Y  %T.",&local);
+}
+
+/*A job for the compression thread: compress segment seq of the log at base
+*/
+struct compressJob
+{
+	char base[100];
+	int seq;
+	int maxSegments;
+};
+
+/*The state of the background thread that compresses closed log segments. The queue is
+a fixed ring so handing off a segment never allocates
+*/
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready; //signalled when a job is queued
+	pthread_cond_t idle; //signalled when the queue is empty and no job is running
+	struct compressJob jobs[COMPRESS_QUEUE_SIZE];
+	int head;
+	int count;
+	bool busy;
+	long bytesIn; //uncompressed bytes read from closed segments
+	long bytesOut; //compressed bytes written
+} compressor = {.lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t compressorOnce = PTHREAD_ONCE_INIT;
+
+/*Gzips the file at path into path.gz (through a temporary file so a half written .gz is
+never left behind) and deletes the original. Returns false if it failed
+*/
+static bool compressFile(const char* path)
+{
+	char tmpPath[120];
+	char gzPath[120];
+	char chunk[16384];
+	size_t n;
+	long in = 0;
+	FILE* src;
+	gzFile dst;
+	struct stat st;
+
+	snprintf(tmpPath, sizeof(tmpPath), "%s.gz.tmp", path);
+	snprintf(gzPath, sizeof(gzPath), "%s.gz", path);
+
+	src = fopen(path, "r");
+	if (!src)
+		return false;
+	dst = gzopen(tmpPath, "wb6");
+	if (!dst)
+	{
+		fclose(src);
+		return false;
+	}
+
+	while ((n = fread(chunk, 1, sizeof(chunk), src)) > 0)
+	{
+		gzwrite(dst, chunk, n);
+		in += n;
+	}
+	fclose(src);
+
+	if (gzclose(dst) != Z_OK || rename(tmpPath, gzPath) != 0)
+	{
+		unlink(tmpPath);
+		return false;
+	}
+	unlink(path);
+
+	pthread_mutex_lock(&compressor.lock);
+	compressor.bytesIn += in;
+	if (stat(gzPath, &st) == 0)
+		compressor.bytesOut += st.st_size;
+	pthread_mutex_unlock(&compressor.lock);
+	return true;
+}
+
+/*Deletes the segments of base that are too old to keep now that segment seq exists. It
+walks back from the newest one that has to go until it finds one that is already gone
+*/
+static void deleteOldSegments(const char* base, int seq, int maxSegments)
+{
+	char path[120];
+
+	for (int old = seq - maxSegments; old >= 0; old--)
+	{
+		bool found = false;
+
+		snprintf(path, sizeof(path), "%s.%d.gz", base, old);
+		if (unlink(path) == 0)
+			found = true;
+		snprintf(path, sizeof(path), "%s.%d", base, old);
+		if (unlink(path) == 0)
+			found = true;
+		snprintf(path, sizeof(path), "%s.%d.gz.tmp", base, old);
+		unlink(path);
+
+		if (!found)
+			break;
+	}
+}
+
+/*The compression thread. It runs at the lowest priority so it only uses time the game
+loop doesn't need
+*/
+static void* compressorThread(void* arg)
+{
+	struct compressJob job;
+	char path[120];
+
+	(void) arg; //there is only the one compressor
+
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+
+	while (1)
+	{
+		pthread_mutex_lock(&compressor.lock);
+		while (compressor.count == 0)
+		{
+			compressor.busy = false;
+			pthread_cond_broadcast(&compressor.idle);
+			pthread_cond_wait(&compressor.ready, &compressor.lock);
+		}
+		compressor.busy = true;
+		job = compressor.jobs[compressor.head];
+		compressor.head = (compressor.head + 1) % COMPRESS_QUEUE_SIZE;
+		compressor.count--;
+		pthread_mutex_unlock(&compressor.lock);
+
+		//Compress this segment, and any others still kept that were left uncompressed
+		//because the queue was full when they were closed
+		for (int seq = job.seq; seq > job.seq - job.maxSegments && seq >= 0; seq--)
+		{
+			snprintf(path, sizeof(path), "%s.%d", job.base, seq);
+			if (access(path, F_OK) == 0)
+				compressFile(path);
+		}
+		deleteOldSegments(job.base, job.seq, job.maxSegments);
+	}
+	return NULL;
+}
+
+/*Starts the compression thread, called once through pthread_once
+*/
+static void startCompressor(void)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, compressorThread, NULL) == 0)
+		pthread_detach(thread);
+}
+
+/*Hands segment seq of the log at base to the compression thread. If the queue is full
+the segment is left uncompressed, and is picked up the next time the log is opened
+*/
+static void queueCompression(const char* base, int seq, int maxSegments)
+{
+	pthread_mutex_lock(&compressor.lock);
+	if (compressor.count < COMPRESS_QUEUE_SIZE)
+	{
+		struct compressJob* job = &compressor.jobs[(compressor.head + compressor.count) % COMPRESS_QUEUE_SIZE];
+		snprintf(job->base, sizeof(job->base), "%s", base);
+		job->seq = seq;
+		job->maxSegments = maxSegments;
+		compressor.count++;
+		pthread_cond_signal(&compressor.ready);
+	}
+	pthread_mutex_unlock(&compressor.lock);
+}
+
+/*Blocks until the compression thread has finished everything it was given
+*/
+void waitForCompressor(void)
+{
+	pthread_mutex_lock(&compressor.lock);
+	while (compressor.count > 0 || compressor.busy)
+		pthread_cond_wait(&compressor.idle, &compressor.lock);
+	pthread_mutex_unlock(&compressor.lock);
+}
+
+/*Works out when the segment at path was started from the time on its first line, so its
+age carries on across restarts (the cabinets are switched off every night). If the first
+line can't be read, the time the file was last written is used instead
+*/
+static time_t segmentStartTime(const char* path, const struct stat* st)
+{
+	char first[24];
+	struct tm started = {0};
+	int fd = open(path, O_RDONLY);
+	bool found = false;
+
+	if (fd >= 0)
+	{
+		//The first line starts with "%m-%d-%Y  %T." from getTime()
+		if (pread(fd, first, sizeof(first) - 1, 0) == (ssize_t) sizeof(first) - 1)
+		{
+			first[sizeof(first) - 1] = '\0';
+			found = sscanf(first, "%2d-%2d-%4d  %2d:%2d:%2d.", &started.tm_mon, &started.tm_mday,
+				&started.tm_year, &started.tm_hour, &started.tm_min, &started.tm_sec) == 6;
+		}
+		close(fd);
+	}
+	if (!found)
+		return st->st_mtime;
+
+	started.tm_mon -= 1;
+	started.tm_year -= 1900;
+	started.tm_isdst = -1; //let mktime() work out daylight saving time
+	return mktime(&started);
+}
+
+/*Opens the active segment of log for appending
+*/
+static bool openSegment(struct logger* log)
+{
+	struct stat st;
+
+	log->fd = open(log->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	log->isOpen = (log->fd >= 0);
+	if (!log->isOpen)
+		return false;
+
+	//An existing active segment keeps its size and its age, a new one starts now
+	log->size = (fstat(log->fd, &st) == 0) ? st.st_size : 0;
+	log->openedAt = log->size > 0 ? segmentStartTime(log->path, &st) : time(NULL);
+	log->unflushed = 0;
+	return true;
+}
+
+/*Opens the rotating log at path. It looks through the directory for the newest closed
+segment so numbering carries on after a restart, deletes segments that are past retention
+(e.g. because LOG_MAX_SEGMENTS was lowered), and queues any segment that was closed but
+never compressed (e.g. because of a power cut). Returns false if the log couldn't be opened
+*/
+bool logOpen(struct logger* log, const char* path, const struct options* opts, const int flushBytes)
+{
+	char dirName[100];
+	const char* baseName;
+	size_t baseLength;
+	DIR* dir;
+	struct dirent* entry;
+	int leftovers[COMPRESS_QUEUE_SIZE];
+	int leftoverCount = 0;
+
+	pthread_once(&compressorOnce, startCompressor);
+
+	snprintf(log->path, sizeof(log->path), "%s", path);
+	log->nextSeq = 0;
+	log->maxBytes = opts->logMaxBytes;
+	log->maxAge = opts->logMaxAge;
+	log->maxSegments = opts->logMaxSegments;
+	log->flushBytes = flushBytes;
+	log->bytesWritten = 0;
+	log->flushes = 0;
+	log->rotations = 0;
+
+	//Split the path into its directory and file name
+	baseName = strrchr(path, '/');
+	if (baseName)
+	{
+		snprintf(dirName, sizeof(dirName), "%.*s", (int) (baseName - path), path);
+		baseName++;
+	}
+	else
+	{
+		snprintf(dirName, sizeof(dirName), ".");
+		baseName = path;
+	}
+	baseLength = strlen(baseName);
+
+	dir = opendir(dirName[0] ? dirName : "/");
+	if (dir)
+	{
+		//The first pass finds the newest segment, the second sorts the others into ones
+		//to delete and ones to compress
+		for (int pass = 0; pass < 2; pass++)
+		{
+			while ((entry = readdir(dir)) != NULL)
+			{
+				char* end;
+				long seq;
+
+				//Only look at names of the form <baseName>.<seq>, <baseName>.<seq>.gz
+				//or <baseName>.<seq>.gz.tmp
+				if (strncmp(entry->d_name, baseName, baseLength) != 0 || entry->d_name[baseLength] != '.')
+					continue;
+				seq = strtol(entry->d_name + baseLength + 1, &end, 10);
+				if (end == entry->d_name + baseLength + 1 || seq < 0)
+					continue;
+
+				if (pass == 0)
+				{
+					if (seq >= log->nextSeq)
+						log->nextSeq = seq + 1;
+				}
+				else if (seq < log->nextSeq - log->maxSegments)
+				{
+					//Past retention: deleteOldSegments() stops at the first gap in the
+					//numbering, so it would never get to these
+					char oldPath[360];
+					snprintf(oldPath, sizeof(oldPath), "%s/%s", dirName, entry->d_name);
+					unlink(oldPath);
+				}
+				else if (*end == '\0' && leftoverCount < COMPRESS_QUEUE_SIZE)
+					leftovers[leftoverCount++] = seq;
+			}
+			rewinddir(dir);
+		}
+		closedir(dir);
+	}
+
+	for (int i = 0; i < leftoverCount; i++)
+		queueCompression(log->path, leftovers[i], log->maxSegments);
+
+	return openSegment(log);
+}
+
+/*Writes out everything buffered for the active segment
+*/
+void logFlush(struct logger* log)
+{
+	long written = 0;
+
+	if (log->unflushed > 0 && log->isOpen)
+	{
+		while (written < log->unflushed)
+		{
+			ssize_t n = write(log->fd, log->buffer + written, log->unflushed - written);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break; //the card is full or gone, so what is left is dropped
+			written += n;
+		}
+		log->flushes++;
+	}
+	log->unflushed = 0;
+}
+
+/*Closes the active segment, renames it to path.N and starts a new, empty one. The old
+segment is then compressed on the background thread
+*/
+static void logRotate(struct logger* log)
+{
+	char closedPath[120];
+
+	logFlush(log);
+	close(log->fd);
+	log->isOpen = false;
+
+	snprintf(closedPath, sizeof(closedPath), "%s.%d", log->path, log->nextSeq);
+	if (rename(log->path, closedPath) == 0)
+	{
+		queueCompression(log->path, log->nextSeq, log->maxSegments);
+		log->nextSeq++;
+		log->rotations++;
+	}
+
+	if (!openSegment(log))
+		perror("The log file could not be reopened");
+}
+
+/*Writes one log line as "time : program : message" followed by a blank line. The segment is rotated first if the line
+would take it over the size limit or it is too old, so the newest line is always in the
+active segment
+*/
+void logWrite(struct logger* log, const char* timeStr, const char* programName, const char* str)
+{
+	char line[300];
+	int length = snprintf(line, sizeof(line), "%s : %s : %s\n\n", timeStr, programName, str);
+
+	if (length >= (int) sizeof(line))
+		length = sizeof(line) - 1;
+
+	//The log was never opened
+	if (!log->isOpen)
+		return;
+
+	if (log->size > 0 && (log->size + length > log->maxBytes || time(NULL) - log->openedAt >= log->maxAge))
+		logRotate(log);
+	if (!log->isOpen)
+		return;
+
+	//Make room in the buffer if the line doesn't fit
+	if (log->unflushed + length > (long) sizeof(log->buffer))
+		logFlush(log);
+	memcpy(log->buffer + log->unflushed, line, length);
+	log->size += length;
+	log->bytesWritten += length;
+	log->unflushed += length;
+
+	if (log->unflushed >= log->flushBytes)
+		logFlush(log);
+}
+
+/*Flushes and closes the active segment
+*/
+void logClose(struct logger* log)
+{
+	logFlush(log);
+	if (log->isOpen)
+		close(log->fd);
+	log->isOpen = false;
+}
+
+/*Creates (or reuses) the shared memory segment called name and maps it. Returns NULL if the
+segment could not be set up, in which case the game runs without publishing its state
+*/
+struct gameState* stateOpen (const char* name)
+{
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, sizeof(struct gameState)) != 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	struct gameState* state = mmap(NULL, sizeof(struct gameState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping stays valid without the descriptor
+	if (state == MAP_FAILED)
+		return NULL;
+
+	//A leftover segment from an earlier run might have been killed mid update, so start
+	//again from an even sequence number
+	atomic_store(&state->sequence, 0);
+	memset(&state->payload, 0, sizeof(state->payload));
+	state->version = GAME_STATE_VERSION;
+	return state;
+}
+
+/*Copies the rows being judged (interval intervalCounter-1) and coming next into the payload.
+Intervals outside the song show up as all off
+*/
+void stateRows (struct gameStatePayload* payload, const struct row* song, const int intervalCounter, const int length)
+{
+	const struct row off = {0, 0, 0};
+	const struct row* current = (intervalCounter > 0 && intervalCounter <= length) ? &song[intervalCounter-1] : &off;
+	const struct row* next = (intervalCounter < length) ? &song[intervalCounter] : &off;
+
+	payload->currentRow[0] = current->status1;
+	payload->currentRow[1] = current->status2;
+	payload->currentRow[2] = current->status3;
+	payload->nextRow[0] = next->status1;
+	payload->nextRow[1] = next->status2;
+	payload->nextRow[2] = next->status3;
+}
+
+/*Publishes payload to the shared segment. Does nothing but count the update if the segment
+could not be opened
+*/
+void statePublish (struct gameState* state, struct gameStatePayload* payload)
+{
+	payload->updates++;
+	if (state)
+		gameStateWrite(state, payload);
+}
+
+/*Unmaps the segment. The segment itself is left for readers to see the last state
+*/
+void stateClose (struct gameState* state)
+{
+	if (state)
+		munmap(state, sizeof(*state));
+}
+
+/*Returns the time in milliseconds on the monotonic clock, which doesn't jump when the
+date is changed
+*/
+long long monotonicMs (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*Returns the time in microseconds on the monotonic clock
+*/
+long long monotonicUs (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/*A structure for one checkpoint of a song in progress, written to the checkpoint file at
+every interval boundary so a restarted game can carry on from it. The checksum is a CRC-32
+of every field before it
+*/
+struct checkpointRecord
+{
+	uint32_t magic; //CHECKPOINT_MAGIC
+	uint32_t version; //CHECKPOINT_VERSION
+	uint64_t sequence; //counts every checkpoint ever written, the highest valid one is the newest
+	uint64_t epoch; //the scheduler epoch: which song this is, counted across restarts
+	int64_t savedAt; //wall clock time it was written, in milliseconds
+	int64_t bootMs; //time since the Pi started when it was written, in milliseconds
+	uint32_t bootId; //CRC-32 of the kernel's boot id, which says which boot bootMs belongs to
+	uint32_t chartId; //CRC-32 of the chart being played, so a changed chart file isn't resumed
+	int32_t difficulty;
+	int32_t intervalCounter; //intervals finished
+	int32_t correct; //the score so far
+	int32_t maxIntervals;
+	int32_t active; //1 while the song is being played, 0 once it is over
+	uint32_t checksum;
+};
+
+/*A structure for the layout of the checkpoint file. It has two slots that are written in
+turn, so a checkpoint cut short by a crash always leaves the one before it intact
+*/
+struct checkpointFile
+{
+	struct checkpointRecord slots[2];
+	uint64_t flushes; //times the file has been flushed to the card
+};
+
+/*A structure for the memory mapped checkpoint file. Writing a checkpoint is only a copy into
+the mapping (the kernel keeps the page if the process dies); with sync set, syncThread then
+flushes it to the card so it also survives the watchdog resetting the Pi
+*/
+struct checkpoint
+{
+	struct checkpointFile* file; //NULL if the file couldn't be mapped
+	uint64_t sequence; //of the newest checkpoint
+	uint32_t bootId; //of this boot, read once when the file is opened
+	bool sync;
+	pthread_t syncThread;
+	pthread_mutex_t lock;
+	pthread_cond_t changed; //signalled when there is a checkpoint to flush, or on close
+	bool pending; //a checkpoint is waiting to be flushed
+	bool stop;
+	long saves; //checkpoints written since the stats were last reset
+	long long saveNs; //total time the game loop spent writing them
+	long long maxSaveNs;
+	long syncs; //flushes done by syncThread, and the time they took
+	long long syncUs;
+};
+
+//Identifies a checkpoint file, and is bumped whenever struct checkpointRecord changes
+#define CHECKPOINT_MAGIC 0x505a4746u
+#define CHECKPOINT_VERSION 2
+
+//How far ahead of the wall clock a checkpoint from an earlier boot can be and still be
+//resumed, in milliseconds. It allows for the clock being nudged by NTP, not for it being set
+#define CHECKPOINT_CLOCK_SLACK 2000
+
+/*Returns true if record is a complete checkpoint in the current format
+*/
+bool checkpointValid (const struct checkpointRecord* record)
+{
+	return record->magic == CHECKPOINT_MAGIC && record->version == CHECKPOINT_VERSION &&
+		record->checksum == crc32(0, (const Bytef*) record, offsetof(struct checkpointRecord, checksum));
+}
+
+/*Returns a CRC-32 of the first length rows of song, which identifies the chart
+*/
+uint32_t chartId (const struct row* song, const int length)
+{
+	return crc32(0, (const Bytef*) song, length * sizeof(struct row));
+}
+
+/*Returns the wall clock time in milliseconds
+*/
+long long wallClockMs (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*Returns the time since the Pi started in milliseconds. Setting the date doesn't move it,
+so within one boot it measures how old a checkpoint is even before the clock is right
+*/
+long long bootTimeMs (void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_BOOTTIME, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*Returns a CRC-32 of the kernel's boot id, which is different every time the Pi starts,
+or 0 if it can't be read
+*/
+uint32_t bootId (void)
+{
+	char id[40];
+	FILE* file = fopen("/proc/sys/kernel/random/boot_id", "r");
+
+	if (!file)
+		return 0;
+	if (!fgets(id, sizeof(id), file))
+		id[0] = '\0';
+	fclose(file);
+	return id[0] ? crc32(0, (const Bytef*) id, strlen(id)) : 0;
+}
+
+/*The checkpoint flushing thread: writes the mapped page back to the card every time a new
+checkpoint is waiting. Checkpoints written while a flush is running are flushed together
+*/
+static void* checkpointSyncThread (void* arg)
+{
+	struct checkpoint* cp = (struct checkpoint*) arg;
+
+	pthread_mutex_lock(&cp->lock);
+	while (1)
+	{
+		while (!cp->pending && !cp->stop)
+			pthread_cond_wait(&cp->changed, &cp->lock);
+		if (cp->stop)
+			break;
+		cp->pending = false;
+		pthread_mutex_unlock(&cp->lock);
+
+		long long start = monotonicUs();
+		msync(cp->file, sizeof(struct checkpointFile), MS_SYNC);
+		long long took = monotonicUs() - start;
+
+		//A flushed page is write protected again, and the next write to it takes a page
+		//fault. Counting the flush in the file takes that fault here instead of in the
+		//game loop's next checkpoint
+		cp->file->flushes++;
+
+		pthread_mutex_lock(&cp->lock);
+		cp->syncs++;
+		cp->syncUs += took;
+	}
+	pthread_mutex_unlock(&cp->lock);
+	return NULL;
+}
+
+/*Maps the checkpoint file at path, creating it if needed, and finds the newest checkpoint
+in it. With sync set, each checkpoint is also flushed to the card by a thread of its own.
+Returns false (and cp writes nothing) if the file couldn't be mapped
+*/
+bool checkpointOpen (struct checkpoint* cp, const char* path, const bool sync)
+{
+	const size_t size = sizeof(struct checkpointFile);
+
+	memset(cp, 0, sizeof(*cp));
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, size) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd); //the mapping stays valid without the descriptor
+	if (map == MAP_FAILED)
+		return false;
+	cp->file = (struct checkpointFile*) map;
+	cp->bootId = bootId();
+
+	for (int slot = 0; slot < 2; slot++)
+	{
+		if (checkpointValid(&cp->file->slots[slot]) && cp->file->slots[slot].sequence > cp->sequence)
+			cp->sequence = cp->file->slots[slot].sequence;
+	}
+
+	if (sync)
+	{
+		pthread_mutex_init(&cp->lock, NULL);
+		pthread_cond_init(&cp->changed, NULL);
+		cp->sync = pthread_create(&cp->syncThread, NULL, checkpointSyncThread, cp) == 0;
+		if (!cp->sync)
+		{
+			pthread_cond_destroy(&cp->changed);
+			pthread_mutex_destroy(&cp->lock);
+		}
+	}
+	return true;
+}
+
+/*Copies the newest valid checkpoint into record. Returns false if there isn't one
+*/
+bool checkpointLoad (const struct checkpoint* cp, struct checkpointRecord* record)
+{
+	const struct checkpointRecord* newest = NULL;
+
+	if (!cp->file)
+		return false;
+	for (int slot = 0; slot < 2; slot++)
+	{
+		if (checkpointValid(&cp->file->slots[slot]) && (!newest || cp->file->slots[slot].sequence > newest->sequence))
+			newest = &cp->file->slots[slot];
+	}
+	if (newest)
+		*record = *newest;
+	return newest != NULL;
+}
+
+/*Writes record as the newest checkpoint, filling in its header and checksum. The slot
+holding the older checkpoint is the one overwritten
+*/
+void checkpointSave (struct checkpoint* cp, struct checkpointRecord* record)
+{
+	struct timespec start, end;
+
+	if (!cp->file)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	record->magic = CHECKPOINT_MAGIC;
+	record->version = CHECKPOINT_VERSION;
+	record->sequence = ++cp->sequence;
+	record->savedAt = wallClockMs();
+	record->bootMs = bootTimeMs();
+	record->bootId = cp->bootId;
+	record->checksum = crc32(0, (const Bytef*) record, offsetof(struct checkpointRecord, checksum));
+	cp->file->slots[record->sequence & 1] = *record;
+
+	if (cp->sync)
+	{
+		pthread_mutex_lock(&cp->lock);
+		cp->pending = true;
+		pthread_cond_signal(&cp->changed);
+		pthread_mutex_unlock(&cp->lock);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long long took = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+	cp->saves++;
+	cp->saveNs += took;
+	if (took > cp->maxSaveNs)
+		cp->maxSaveNs = took;
+}
+
+/*Writes a summary of what checkpointing has cost since the last call into line, and starts
+counting again
+*/
+void checkpointStats (struct checkpoint* cp, char* line, const size_t size)
+{
+	long syncs = 0;
+	long long syncUs = 0;
+
+	if (cp->sync)
+	{
+		pthread_mutex_lock(&cp->lock);
+		syncs = cp->syncs;
+		syncUs = cp->syncUs;
+		cp->syncs = 0;
+		cp->syncUs = 0;
+		pthread_mutex_unlock(&cp->lock);
+	}
+
+	snprintf(line, size, "Checkpoints %.2f us average, %.2f us max (%ld written); %ld flushed in %.2f ms average",
+		cp->saves ? cp->saveNs / 1000.0 / cp->saves : 0.0, cp->maxSaveNs / 1000.0, cp->saves,
+		syncs, syncs ? syncUs / 1000.0 / syncs : 0.0);
+	cp->saves = 0;
+	cp->saveNs = 0;
+	cp->maxSaveNs = 0;
+}
+
+/*Stops the flushing thread (after one last flush) and unmaps the file
+*/
+void checkpointClose (struct checkpoint* cp)
+{
+	if (!cp->file)
+		return;
+	if (cp->sync)
+	{
+		pthread_mutex_lock(&cp->lock);
+		cp->stop = true;
+		pthread_cond_signal(&cp->changed);
+		pthread_mutex_unlock(&cp->lock);
+		pthread_join(cp->syncThread, NULL);
+		pthread_cond_destroy(&cp->changed);
+		pthread_mutex_destroy(&cp->lock);
+		cp->sync = false;
+	}
+	msync(cp->file, sizeof(struct checkpointFile), MS_SYNC);
+	munmap(cp->file, sizeof(struct checkpointFile));
+	cp->file = NULL;
+}
+
+/*
+ * Return the most recent score in the score log file
+ */
+int getPreviousScore(char* scoreFileName)
+{
+	int scoreFile;
+	//Length of the score, leading zeroes and null character included
+	const int scoreLength = 2 + 1;
+
+	//Int variable that holds the previous score: it's the return value
+	int score = 0;
+
+	//Index to loop through the previous score in the file
+	int i = 0;
+
+	//The two digits of the score, and the file's size to find them with
+	char digits[2];
+	struct stat st;
+
+	//Open the score file in read mode (open() rather than fopen(), which allocates)
+	scoreFile = open(scoreFileName, O_RDONLY);
+	//File exists
+	if (scoreFile >= 0)
+	{
+		//Read the two digits starting at the first leading 0
+		if (fstat(scoreFile, &st) == 0 && st.st_size > scoreLength &&
+			pread(scoreFile, digits, 2, st.st_size - scoreLength - 1) == 2)
+		{
+			//loop 2 times only
+			while (i < 2)
+			{
+				//Convert score from char to int
+				score = (score*10) + (digits[i] - '0');
+				i++;
+			}
+		}
+		//close the score file
+		close(scoreFile);
+	}
+
+	//return the previous score
+	return score;
+}
+
+/*
+ * Reads the chart for a difficulty (EASY_SONG, MEDIUM_SONG or HARD_SONG) into song. Rows past
+ * the end of the chart file are blank
+ */
+void loadChart (struct row* const song, const int difficulty, const int MAX_INTERVALS)
+{
+	const char* songPaths[3] = {HOME_DIR "easySong.log", HOME_DIR "medSong.log", HOME_DIR "hardSong.log"};
+	const char* songPath = songPaths[difficulty];
+
+	int i = 0;
+
+	//Number of character per line in the song files
+	int bufferSize = 7;
+
+	//Char array to hold each line
+	char buffer[bufferSize];
+
+	//counts the number of intervals
+	int intervalCount = 0;
+
+	//holds the desired statuses of the buttons as seen in the song
+	int statusArr[3] = {0};
+
+	//The whole song file is read in one go into this array, so no FILE has to be allocated
+	char text[MAX_ROWS * bufferSize + 1];
+	int textLength = 0;
+	int position = 0;
+
+	int songFile = open(songPath, O_RDONLY);
+	if (songFile >= 0)
+	{
+		textLength = read(songFile, text, sizeof(text) - 1);
+		if (textLength < 0)
+			textLength = 0;
+		//close the song file
+		close(songFile);
+	}
+
+	//Current interval is less than the max interval and the text is not at the end of the file
+	for (intervalCount = 0; (intervalCount < MAX_INTERVALS && position < textLength); intervalCount++)
+	{
+		//Take the next line, at most bufferSize-1 characters of it like fgets() would
+		int lineLength = 0;
+		while (lineLength < bufferSize - 1 && position < textLength)
+		{
+			buffer[lineLength] = text[position];
+			lineLength++;
+			position++;
+			if (buffer[lineLength - 1] == '\n')
+				break;
+		}
+		buffer[lineLength] = '\0';
+
+		i = 0;
+		for (int j = 0; j < 6; j += 2)
+		{
+			//Assign the statuses to the status array
+			statusArr[i] = buffer[j] - '0';
+			i++;		
+		}
+		
+		//Assign the statuses to the status fields in the row struct (which is in an array for row structs)
+		song[intervalCount] = (struct row) {.status1 = statusArr[0], .status2 = statusArr[1], .status3 = statusArr[2]};
+	}
+
+	//Rows past the end of the file are blank
+	for (; intervalCount < MAX_INTERVALS; intervalCount++)
+		song[intervalCount] = (struct row) {.status1 = 0, .status2 = 0, .status3 = 0};
+}
+
+/*
+ * Assigns a song with a set difficulty for the user to play based on their most recent score in the score log.
+ * Returns the difficulty picked (EASY_SONG, MEDIUM_SONG or HARD_SONG)
+ */
+int assignSong (struct row* const song, char* scoreFileName, const int MAX_INTERVALS)
+{
+	//Get the most recent score
+	int score = getPreviousScore(scoreFileName);
+
+	//Establish 2 thresholds as a percentage of the max interval
+	const int threshold1 = MAX_INTERVALS/3;
+	const int threshold2 = 2*threshold1;
+
+	int difficulty;
+
+	//Output previous score for user to see
+	printf("Previous Score: %d\n", score);
+
+	//If the score is below 33% of the MAX_INTERVAL size, select the easy song
+	if (score < threshold1)
+	{
+		printf("Currently Playing: Easy Song\n");
+		fflush(stdout);
+		difficulty = EASY_SONG;
+	}
+	//Score is above 33% and below 66%, select the medium song
+	else if (score >= threshold1 && score < threshold2)
+	{
+		printf("Currently Playing: Medium Song\n");
+		fflush(stdout);
+		difficulty = MEDIUM_SONG;
+	}
+	//Score is above 66%, select the hard song
+	else
+	{
+		printf("Currently Playing: Hard Song\n");
+		fflush(stdout);
+		difficulty = HARD_SONG;
+	}
+
+	loadChart(song, difficulty, MAX_INTERVALS);
+	return difficulty;
+}
+
+/*
+ * Update the score log file with the new score
+ */
+void updateScore (struct logger* scoreLog, const int score, const char* programName, char* time) //update the log file
+{
+	//Check if the score is invalid
+	if (score < 0 || score > 30)
+	{
+		//Warn the user and exit the function
+		perror("Invalid Score");
+		return;
+	}
+
+	//Number of digits
+	int n = log10(score) + 1;
+	//Hold a temp score for to convert from int to str
+	int tempScore = score;
+	//Holds the str of the score
+	char scoreStr[3];
+	//Add a null terminator
+	scoreStr[2] = '\0';
+	for (int i = 1; i >= 0; i--)
+	{
+		//If the current index is outside the number of digits (leading 0s), put a '0' char in front
+		if (i < 2 - n)
+		{
+			scoreStr[i] = '0';
+		}
+		//Current index is inside the number of digits (actual score value)
+		else
+		{
+			//Assign the digit to the score str
+			scoreStr[i] = tempScore % 10 + '0';
+			//Divide by 10 (integer division: no decimals), to get the next digit
+			tempScore /= 10;
+		}
+	}
+	//Log the score to the score log file (the score log flushes every line, so
+	//getPreviousScore always sees it)
+	LOG_MSG(scoreLog, time, programName, scoreStr);
+}
+
+/*The steps of the startup pipeline. The order is also the order they are run in when the
+pipeline runs serially, so every step comes after the steps it depends on
+*/
+enum startupStepId
+{
+	STEP_CONFIG,
+	STEP_LOG,
+	STEP_GPIO,
+	STEP_AUDIO,
+	STEP_BAD_CUE,
+	STEP_NICE_CUE,
+	STEP_CHECKPOINT,
+	STEP_SCORE,
+	STEP_CHART,
+	STEP_COUNT
+};
+
+//Used to build the dependency mask of a startup step
+#define AFTER(step) (1u << (step))
+
+//The steps the game can't run without: with no config, logs or chart the game loop would
+//run on values that were never set. A song without sound or checkpoints is still playable
+#define FATAL_STEPS (AFTER(STEP_CONFIG) | AFTER(STEP_LOG) | AFTER(STEP_CHART))
+
+//The steps nothing is needed from until a sound is played. They carry on in the background
+//while the game waits for input, and are joined before the first cue. No other step may
+//depend on them
+#define BACKGROUND_STEPS (AFTER(STEP_AUDIO) | AFTER(STEP_BAD_CUE) | AFTER(STEP_NICE_CUE))
+
+struct startup;
+
+/*A structure for the argument of a startup thread
+*/
+struct startupTask
+{
+	struct startup* st;
+	int step;
+};
+
+/*A structure for everything the startup pipeline sets up. Like readConfig, the results are
+written through pointers to main's variables. The timeline is in milliseconds since t0
+*/
+struct startup
+{
+	const char* programName;
+	const struct ledPins* LEDs;
+	const struct buttons* butts;
+
+	int* intervalTime;
+	int* timeoutTimer;
+	int* MAX_INTERVALS;
+	char* logFileName;
+	char* badSoundPath;
+	char* niceSoundPath;
+	struct options* opts;
+	struct logger* logFile;
+	struct logger* scoreLog;
+	GPIO_Handle* gpio;
+	struct audioOutput* audio;
+	struct soundCue* badCue;
+	struct soundCue* niceCue;
+	struct row* song;
+	struct compiledChart* chart;
+	int* difficulty;
+	struct arena* arena;
+	struct backingTrack* backing;
+	struct checkpoint* checkpoint;
+	struct checkpointRecord* resume; //the checkpoint the song is resumed from
+	bool* resuming; //set if a song is resumed instead of starting a new one
+	bool keepScore; //the game was running a moment ago, so the score log isn't reset
+
+	struct timespec t0;
+	double stepStart[STEP_COUNT];
+	double stepEnd[STEP_COUNT];
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed; //signalled whenever a step finishes
+	unsigned finished; //mask of the steps that have finished
+	unsigned failed; //mask of the steps that failed or were skipped
+
+	pthread_t threads[STEP_COUNT];
+	struct startupTask tasks[STEP_COUNT];
+	bool started[STEP_COUNT]; //the steps that got a thread of their own
+	bool running; //the background steps haven't been joined yet
+};
+
+/*A structure that describes a startup step: its name, the mask of steps that must finish
+before it can start, and the function that runs it
+*/
+struct startupStep
+{
+	const char* name;
+	unsigned deps;
+	bool (*run)(struct startup* st);
+};
+
+/*Returns the number of milliseconds since the startup pipeline began
+*/
+double startupMs (const struct startup* st)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - st->t0.tv_sec) * 1e3 + (now.tv_nsec - st->t0.tv_nsec) / 1e6;
+}
+
+//Reads the six standard params and the optional params from the config file
+static bool runConfigStep (struct startup* st)
+{
+	FILE* configFile = fopen(HOME_DIR "GuitarZero.cfg", "r");
+	if (!configFile)
+	{
+		perror("The config file could not be opened");
+		return false;
+	}
+	readConfig(configFile, st->logFileName, st->intervalTime, st->timeoutTimer, st->MAX_INTERVALS, st->badSoundPath, st->niceSoundPath);
+	readOptions(configFile, st->opts);
+	fclose(configFile);
+
+	//The song arrays only have room for MAX_ROWS rows
+	if (*st->MAX_INTERVALS > MAX_ROWS)
+		*st->MAX_INTERVALS = MAX_ROWS;
+
+	//All the memory the session needs for sound is taken now, in one go
+	if (!arenaInit(st->arena, st->opts->arenaBytes))
+	{
+		perror("The session arena could not be allocated");
+		return false;
+	}
+	return true;
+}
+
+//Opens the game log and the score log
+static bool runLogStep (struct startup* st)
+{
+	bool ok = true;
+	if (!logOpen(st->logFile, st->logFileName, st->opts, st->opts->logFlushBytes))
+	{
+		perror("The log file could not be opened");
+		ok = false;
+	}
+	if (!logOpen(st->scoreLog, HOME_DIR "score.log", st->opts, 0))
+	{
+		perror("The score log could not be opened");
+		ok = false;
+	}
+	return ok;
+}
+
+//Maps the GPIO registers, sets up the pins (including the gpio_alt fork) and turns the LEDs off
+static bool runGpioStep (struct startup* st)
+{
+	*st->gpio = initializePins(*st->LEDs);
+	setAllOff(*st->gpio, *st->LEDs);
+	return true;
+}
+
+//Opens the audio output backend chosen in the config, and the backing track's output in practice mode
+static bool runAudioStep (struct startup* st)
+{
+	if (!audioOpen(st->audio, st->opts))
+	{
+		fprintf(stderr, "The audio device could not be opened\n");
+		return false;
+	}
+	if (st->opts->practiceSpeed != 100 && !backingOpen(st->backing, st->arena, st->opts))
+		fprintf(stderr, "The backing track output could not be opened\n");
+	return true;
+}
+
+//Decodes the two sound cues
+static bool runBadCueStep (struct startup* st)
+{
+	return decodeSound(st->badSoundPath, st->badCue, st->arena);
+}
+
+static bool runNiceCueStep (struct startup* st)
+{
+	return decodeSound(st->niceSoundPath, st->niceCue, st->arena);
+}
+
+/*Maps the checkpoint file and decides whether the game picks up where it was stopped: a
+song that was checkpointed less than RESUME_WINDOW seconds ago is resumed if its chart
+hasn't changed. The game runs without checkpoints if the file can't be opened, so this
+step never fails
+*/
+static bool runCheckpointStep (struct startup* st)
+{
+	struct checkpointRecord* saved = st->resume;
+
+	*st->resuming = false;
+	st->keepScore = false;
+	if (!checkpointOpen(st->checkpoint, HOME_DIR "checkpoint.bin", st->opts->checkpointSync))
+	{
+		perror("The checkpoint file could not be opened");
+		return true;
+	}
+	if (!checkpointLoad(st->checkpoint, saved) || st->opts->resumeWindow <= 0)
+		return true;
+
+	//A checkpoint from this boot is timed with the boot clock, which setting the date can't
+	//move. One from an earlier boot only has the wall clock, and after a reset fake-hwclock
+	//starts that at the time it last saved, which can be behind the checkpoint. Then how old
+	//the checkpoint is can't be known, so one from the future is never resumed
+	long long age;
+	if (saved->bootId != 0 && saved->bootId == st->checkpoint->bootId)
+		age = bootTimeMs() - saved->bootMs;
+	else
+		age = wallClockMs() - saved->savedAt;
+	if (age < -CHECKPOINT_CLOCK_SLACK || age > st->opts->resumeWindow * 1000LL)
+		return true;
+	st->keepScore = true;
+
+	if (!saved->active || saved->maxIntervals != *st->MAX_INTERVALS || saved->intervalCounter >= saved->maxIntervals ||
+		saved->difficulty < EASY_SONG || saved->difficulty > HARD_SONG)
+		return true;
+
+	loadChart(st->song, saved->difficulty, *st->MAX_INTERVALS);
+	if (chartId(st->song, *st->MAX_INTERVALS) != saved->chartId)
+		return true;
+	*st->difficulty = saved->difficulty;
+	*st->resuming = true;
+	return true;
+}
+
+//User always starts with the easy song upon boot, unless the game was only just stopped
+static bool runScoreStep (struct startup* st)
+{
+	char logTime[30];
+	if (!st->keepScore)
+		updateScore(st->scoreLog, 0, st->programName, logTime);
+	return true;
+}
+
+//Loads the chart for the (just reset) score and compiles it for our pins. A resumed song's
+//chart was already loaded by the checkpoint step
+static bool runChartStep (struct startup* st)
+{
+	if (!*st->resuming)
+		*st->difficulty = assignSong(st->song, HOME_DIR "score.log", *st->MAX_INTERVALS);
+	compileChart(st->chart, st->song, *st->MAX_INTERVALS, *st->LEDs, *st->butts);
+	return true;
+}
+
+//The startup dependency graph
+static const struct startupStep startupSteps[STEP_COUNT] =
+{
+	[STEP_CONFIG] = {"config", 0, runConfigStep},
+	[STEP_LOG] = {"log", AFTER(STEP_CONFIG), runLogStep},
+	[STEP_GPIO] = {"gpio", 0, runGpioStep},
+	[STEP_AUDIO] = {"audio", AFTER(STEP_CONFIG), runAudioStep},
+	[STEP_BAD_CUE] = {"badCue", AFTER(STEP_CONFIG), runBadCueStep},
+	[STEP_NICE_CUE] = {"niceCue", AFTER(STEP_CONFIG), runNiceCueStep},
+	[STEP_CHECKPOINT] = {"checkpoint", AFTER(STEP_CONFIG), runCheckpointStep},
+	[STEP_SCORE] = {"score", AFTER(STEP_LOG) | AFTER(STEP_CHECKPOINT), runScoreStep},
+	[STEP_CHART] = {"chart", AFTER(STEP_CONFIG) | AFTER(STEP_CHECKPOINT) | AFTER(STEP_SCORE), runChartStep},
+};
+
+/*Runs one step: waits for its dependencies, runs it (unless a dependency failed, in which
+case it is skipped and counts as failed too), and records when it started and finished
+*/
+static void runStartupStep (struct startup* st, const int step)
+{
+	const unsigned deps = startupSteps[step].deps;
+	bool ok = false;
+
+	pthread_mutex_lock(&st->lock);
+	while ((st->finished & deps) != deps)
+		pthread_cond_wait(&st->changed, &st->lock);
+	bool depsOk = (st->failed & deps) == 0;
+	pthread_mutex_unlock(&st->lock);
+
+	st->stepStart[step] = startupMs(st);
+	if (depsOk)
+		ok = startupSteps[step].run(st);
+	st->stepEnd[step] = startupMs(st);
+
+	pthread_mutex_lock(&st->lock);
+	st->finished |= AFTER(step);
+	if (!ok)
+		st->failed |= AFTER(step);
+	pthread_cond_broadcast(&st->changed);
+	pthread_mutex_unlock(&st->lock);
+}
+
+static void* startupThread (void* arg)
+{
+	struct startupTask* task = (struct startupTask*) arg;
+	runStartupStep(task->st, task->step);
+	return NULL;
+}
+
+/*Runs the startup pipeline. In parallel mode every step gets its own thread and starts as
+soon as its dependencies are done, otherwise the steps run one after another. It returns
+without waiting for the BACKGROUND_STEPS, which finishStartup joins. Returns true if every
+other step succeeded
+*/
+bool runStartup (struct startup* st, const bool parallel)
+{
+	clock_gettime(CLOCK_MONOTONIC, &st->t0);
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->changed, NULL);
+	st->finished = 0;
+	st->failed = 0;
+	st->running = true;
+
+	//mpg123_init() must be called once before any decoder is created
+	mpg123_init();
+
+	for (int step = 0; step < STEP_COUNT; step++)
+	{
+		st->tasks[step] = (struct startupTask) {st, step};
+		st->started[step] = parallel && pthread_create(&st->threads[step], NULL, startupThread, &st->tasks[step]) == 0;
+		//Run it on this thread if it is serial or the thread couldn't be made
+		if (!st->started[step])
+			runStartupStep(st, step);
+	}
+
+	for (int step = 0; step < STEP_COUNT; step++)
+	{
+		if (st->started[step] && !(BACKGROUND_STEPS & AFTER(step)))
+			pthread_join(st->threads[step], NULL);
+	}
+
+	pthread_mutex_lock(&st->lock);
+	bool ok = (st->failed & ~BACKGROUND_STEPS) == 0;
+	pthread_mutex_unlock(&st->lock);
+	return ok;
+}
+
+/*Waits for the steps runStartup left running in the background. Returns true if every
+step succeeded. It can be called again once they are joined
+*/
+bool finishStartup (struct startup* st)
+{
+	if (st->running)
+	{
+		for (int step = 0; step < STEP_COUNT; step++)
+		{
+			if (st->started[step] && (BACKGROUND_STEPS & AFTER(step)))
+				pthread_join(st->threads[step], NULL);
+		}
+		pthread_cond_destroy(&st->changed);
+		pthread_mutex_destroy(&st->lock);
+		st->running = false;
+	}
+	return st->failed == 0;
+}
+
+/*Writes the start and end time of the given startup steps to the log
+*/
+void logStartupTimeline (const struct startup* st, struct logger* logFile, char* logTime, const unsigned steps)
+{
+	char line[100];
+
+	for (int step = 0; step < STEP_COUNT; step++)
+	{
+		if (!(steps & AFTER(step)))
+			continue;
+		snprintf(line, sizeof(line), "Startup %s: %.2f ms to %.2f ms%s", startupSteps[step].name,
+			st->stepStart[step], st->stepEnd[step], (st->failed & AFTER(step)) ? " (failed)" : "");
+		LOG_MSG(logFile, logTime, st->programName, line);
+	}
+}
+
+/*A structure that holds everything a song needs from one song to the next. The game and the
+benchmark both play their songs with playSong, the benchmark with a clock of its own and no
+sleep between polls
+*/
+struct game
+{
+	const char* programName;
+	int intervalTime;
+	int maxIntervals;
+	struct options* opts;
+	struct logger* logFile;
+	struct logger* scoreLog;
+	GPIO_Handle gpio;
+	struct ledPins LEDs;
+	struct buttons butts;
+	struct row* song;
+	struct compiledChart* chart;
+	int difficulty;
+	bool chartReady; //the song and chart are already picked, so the next song doesn't pick one
+	const char* const* songTracks; //the backing track of each song, played in practice mode
+	struct audioOutput* audio;
+	const struct soundCue* badCue;
+	const struct soundCue* niceCue;
+	struct backingTrack* backing;
+	struct arena* arena;
+	struct gameState* liveState;
+	struct gameStatePayload* live;
+	struct checkpoint* checkpoint;
+	struct checkpointRecord* saved; //the song's checkpoint, which a resumed song starts from
+	bool resuming; //the next song carries on from saved instead of starting over
+	const struct startup* boot; //the startup of the first song, to log how long it took. NULL after it
+	struct startup* pending; //the startup whose background steps haven't been joined. NULL after it
+
+	int pollUs; //how long to sleep between polls of the laser
+	long long (*clockMs)(void); //the clock the intervals are timed with
+};
+
+/*Waits for the startup steps that were still opening the audio device and decoding the
+cues when the first song began, and logs how long they took
+*/
+static void joinStartup (struct game* g, char* logTime)
+{
+	if (g->pending == NULL)
+		return;
+	if (!finishStartup(g->pending))
+		fprintf(stderr, "Not every startup step succeeded, see the log\n");
+	logStartupTimeline(g->pending, g->logFile, logTime, BACKGROUND_STEPS);
+	g->pending = NULL;
+}
+
+/*Plays one song, from picking it to logging the score, and returns the score. The caller
+flashes the LEDs and pauses before the next one
+*/
+int playSong (struct game* g)
+{
+	const char* songNames[3] = {"easy", "medium", "hard"}; //how each song is named in the log
+	char songLine[60]; //which song is played and where it starts, logged for the log analyzer
+	char arenaLine[100]; //how much of the arena has been used, logged after each song
+	char audioLine[150]; //the output latency summary that is logged after each song
+	char checkpointLine[150]; //what checkpointing cost, logged after each song
+	char logTime[30];
+	struct gameStatePayload* live = g->live;
+	struct checkpointRecord* saved = g->saved;
+
+	if (!g->chartReady)
+	{
+		//The pins were set up by the startup pipeline and stay mapped between songs
+
+		//Assign a song file based on the score
+		g->difficulty = assignSong(g->song, HOME_DIR "score.log", g->maxIntervals); //assign a song ready to be played based on previous scores, uses the log file
+		compileChart(g->chart, g->song, g->maxIntervals, g->LEDs, g->butts); //work out the register masks for the song
+
+		//Turn off all lecs
+		setAllOff(g->gpio, g->LEDs);
+	}
+	g->chartReady = false;
+
+	if (!g->resuming)
+		LOG_MSG(g->logFile, logTime, g->programName, "Waiting for Input");
+	if (g->boot != NULL)
+	{
+		char line[50];
+		snprintf(line, sizeof(line), "Ready %.2f ms after startup", startupMs(g->boot));
+		LOG_MSG(g->logFile, logTime, g->programName, line);
+	}
+	logFlush(g->logFile); //nothing else is logged until a button is pressed
+
+	live->phase = PHASE_WAITING;
+	live->difficulty = g->difficulty;
+	live->practiceSpeed = g->opts->practiceSpeed;
+	live->intervalCounter = 0;
+	live->maxIntervals = g->maxIntervals;
+	live->correct = 0;
+	live->lastJudgement = JUDGEMENT_NONE;
+	live->strums = 0;
+	live->lastIntervalLateMs = 0;
+	live->maxPollGapUs = 0;
+	stateRows(live, g->song, 0, g->maxIntervals);
+	statePublish(g->liveState, live);
+
+	//In practice mode the backing track is decoded now, so it is ready to start on the
+	//song's first interval. Its output is opened by the audio startup step
+	if (g->opts->practiceSpeed != 100)
+		joinStartup(g, logTime);
+	int startInterval = g->resuming ? saved->intervalCounter : 0; //a resumed song carries on from its checkpoint
+	bool backingPrepared = g->opts->practiceSpeed != 100 && prepareBackingTrack(g->backing,
+		g->songTracks[g->difficulty], g->opts->practiceSpeed, startInterval * g->intervalTime * 1000LL);
+
+	while (!g->resuming && anythingPressed(g->butts, g->gpio)) //program does nothing until a button, any button is pressed (a resumed song carries straight on)
+	{
+		//This ioctl call will write to the watchdog file and prevent 
+		//the system from rebooting. It does this every 2 seconds, so 
+		//setting the watchdog timer lower than this will cause the timer
+		//to reset the Pi after 1 second
+		/*ioctl(watchdog, WDIOC_KEEPALIVE, 0);
+		//Log that the Watchdog was kicked
+		LOG_MSG(&logFile, logTime, programName, "The Watchdog was kicked\n\n");*/
+
+		usleep(500000);
+	}
+
+	int intervalCounter = startInterval; //counter used to run through song during the "song"
+	updateLEDsCompiled (g->chart, intervalCounter, g->gpio);
+	int correct = g->resuming ? saved->correct : 0; //counts how many rows they got correct for highscore purposes
+	bool gotItRight = false; //used to determine outcome at the end of the time interval
+	//In practice mode every interval is stretched by the same factor as the backing track
+	const long long intervalMs = g->intervalTime * 1000LL * 100 / g->opts->practiceSpeed;
+	long long currentTime; //when the current interval started
+	long long lastPoll; //when the laser was last checked, for the poll gap
+	bool wasStrummed = false; //whether the laser was broken at the last poll
+
+	if (g->resuming)
+	{
+		char line[100];
+		snprintf(line, sizeof(line), "Resumed song %llu at interval %d with a score of %d, %.2f ms after startup",
+			(unsigned long long) saved->epoch, intervalCounter, correct, startupMs(g->boot));
+		LOG_MSG(g->logFile, logTime, g->programName, line);
+	}
+	else
+	{
+		//A new song starts a new epoch
+		*saved = (struct checkpointRecord) {.epoch = saved->epoch + 1, .chartId = chartId(g->song, g->maxIntervals),
+			.difficulty = g->difficulty, .maxIntervals = g->maxIntervals, .active = true};
+		checkpointSave(g->checkpoint, saved);
+	}
+	g->resuming = false;
+	g->boot = NULL;
+
+	LOG_MSG(g->logFile, logTime, g->programName, "Game Comencing");
+	snprintf(songLine, sizeof(songLine), "Playing the %s song from interval %d", songNames[g->difficulty], intervalCounter);
+	LOG_MSG(g->logFile, logTime, g->programName, songLine);
+	if (g->opts->practiceSpeed != 100)
+	{
+		char line[100];
+		snprintf(line, sizeof(line), "Practice mode at %d%% speed", g->opts->practiceSpeed);
+		LOG_MSG(g->logFile, logTime, g->programName, line);
+		if (!backingPrepared)
+			LOG_MSG(g->logFile, logTime, g->programName, "The backing track could not be played");
+	}
+
+	//The song's clock and the backing track start together
+	currentTime = g->clockMs();
+	lastPoll = monotonicUs();
+	playBackingTrack(g->backing);
+
+	live->phase = PHASE_PLAYING;
+	live->intervalMs = intervalMs;
+	live->songStartMs = currentTime;
+	live->intervalCounter = intervalCounter;
+	live->correct = correct;
+	stateRows(live, g->song, intervalCounter, g->maxIntervals);
+	statePublish(g->liveState, live);
+
+	while (intervalCounter < g->maxIntervals) //loops until song is over
+	{
+
+		if (g->pollUs > 0)
+			usleep(g->pollUs);
+
+		long long pollTime = monotonicUs();
+		if (pollTime - lastPoll > live->maxPollGapUs)
+			live->maxPollGapUs = pollTime - lastPoll;
+		lastPoll = pollTime;
+
+		bool strummed = ifStrummed(g->gpio);
+		if (strummed && !wasStrummed) //a new break of the laser
+		{
+			live->strums++;
+			statePublish(g->liveState, live);
+		}
+		wasStrummed = strummed;
+
+		if (strummed) //they strummed (broke) the laser, so we need to check buttons
+		{
+			LOG_MSG(g->logFile, logTime, g->programName, "Laser Strummed");
+			if (intervalCounter > 0 && checkButtonsCompiled(g->chart, intervalCounter-1, g->gpio)) //check if they are correct
+				gotItRight = true; //they were correct
+		}
+		long long elapsed = g->clockMs()-currentTime;
+		if (elapsed >= intervalMs) //if the interval is over
+		{		
+			/*ioctl(watchdog, WDIOC_KEEPALIVE, 0);
+			LOG_MSG(&logFile, logTime, programName, "The Watchdog was kicked\n\n");*/
+
+			joinStartup(g, logTime); //the first song's cues may still have been decoding
+
+			if (gotItRight) //if they were correct
+			{
+				LOG_MSG(g->logFile, logTime, g->programName, "Correct Response");
+				correct++; //increase their score
+				playCue(g->audio, g->niceCue); //play a rewarding sound
+			}
+			else //they were wrong
+			{
+				LOG_MSG(g->logFile, logTime, g->programName, "Incorrect Response");
+				if (intervalCounter > 0) //if this is not the first interval, since there is a grace period
+					playCue(g->audio, g->badCue); //play that bad sound
+			}
+			live->lastJudgement = gotItRight ? JUDGEMENT_CORRECT : JUDGEMENT_INCORRECT;
+			live->lastIntervalLateMs = elapsed - intervalMs;
+			gotItRight = false; //set false for next interval
+			intervalCounter++; //increase the row that we are on
+			//In practice mode the intervals keep to the backing track, so each one starts
+			//a fixed time after the last however long the cue took to play. Otherwise the
+			//next interval starts once the cue has played
+			if (g->opts->practiceSpeed != 100)
+			{
+				currentTime += intervalMs;
+
+				//If the cue (or a stall) took up the whole of the next interval there was no
+				//time to answer it, so it is missed and the song carries on in step with the
+				//backing track
+				int missed = 0;
+				while (g->clockMs() - currentTime >= intervalMs && intervalCounter < g->maxIntervals)
+				{
+					LOG_MSG(g->logFile, logTime, g->programName, "Incorrect Response");
+					intervalCounter++;
+					currentTime += intervalMs;
+					missed++;
+				}
+				if (missed > 0)
+				{
+					char line[80];
+					snprintf(line, sizeof(line), "Fell behind the backing track, %d interval%s missed", missed, missed > 1 ? "s" : "");
+					LOG_MSG(g->logFile, logTime, g->programName, line);
+					live->lastJudgement = JUDGEMENT_INCORRECT;
+				}
+			}
+			else
+				currentTime = g->clockMs(); //sets new current time
+			updateLEDsCompiled (g->chart, intervalCounter, g->gpio); //update the LEDs
+
+			live->intervalCounter = intervalCounter;
+			live->correct = correct;
+			stateRows(live, g->song, intervalCounter, g->maxIntervals);
+			statePublish(g->liveState, live);
+
+			saved->intervalCounter = intervalCounter;
+			saved->correct = correct;
+			checkpointSave(g->checkpoint, saved);
+		}
+
+		
+	}	
+	stopBackingTrack(g->backing);
+	live->phase = PHASE_FINISHED;
+	statePublish(g->liveState, live);
+	updateScore(g->scoreLog, correct, g->programName, logTime);
+	saved->active = false; //the score is safe, a restart from here starts a new song
+	checkpointSave(g->checkpoint, saved);
+	LOG_MSG(g->logFile, logTime, g->programName, "Song completed and score updated");
+	checkpointStats(g->checkpoint, checkpointLine, sizeof(checkpointLine));
+	LOG_MSG(g->logFile, logTime, g->programName, checkpointLine);
+	audioStats(g->audio, audioLine, sizeof(audioLine));
+	LOG_MSG(g->logFile, logTime, g->programName, audioLine);
+	snprintf(arenaLine, sizeof(arenaLine), "Session arena %zu of %zu KB used at most",
+		g->arena->peak / 1024, g->arena->size / 1024);
+	LOG_MSG(g->logFile, logTime, g->programName, arenaLine);
+	printf("Your score is: %d\n", correct);
+	fflush(stdout);
+	logFlush(g->logFile); //write out the whole song's log in one go
+	return correct;
+}
+
+int main (const int argc, const char* const argv[])
+{
+
+	//Create a string that contains the program name
+	const char* argName = argc > 0 ? argv[0] : "./GuitarZero";
+
+	//These variables will be used to count how long the name of the program is
+	int i = 0;
+	int namelength = 0;
 
 	while(argName[i] != 0)
 	{
@@ -729,36 +3193,101 @@ int main (const int argc, const char* const argv[])
 		programName[i] = argName[i + 2];
 		i++;
 	}
+	programName[i] = '\0';
 
 	char logTime[30];
 
-	FILE* configFile;
-	configFile = fopen("/home/pi/GuitarZero.cfg", "r");
-
-	if (!configFile)
-	{
-		perror("The config file could not be opened");
-	}
-
 	int INTERVAL_TIME; //The time between intervals excluding sound time
 	int timeoutTimer; //The time until the watchdog will reset the program
 	int MAX_INTERVALS; //The maximum amount of intervals that will be run specifed by the config file
-	char logFileName[50]; //The name of the log file specificed by the config file
-	char badSoundPath[50]; //The name of the error sound file specified by the config sound
-	char niceSoundPath[50]; //The name of the nice sound file specified by the config sound
+	char logFileName[MAX_PATH_LENGTH]; //The name of the log file specificed by the config file
+	char badSoundPath[MAX_PATH_LENGTH]; //The name of the error sound file specified by the config sound
+	char niceSoundPath[MAX_PATH_LENGTH]; //The name of the nice sound file specified by the config sound
 
-	//Read the config file and assign values to the passed variables
-	readConfig(configFile, logFileName, &INTERVAL_TIME, &timeoutTimer, &MAX_INTERVALS, badSoundPath, niceSoundPath);
+	struct options opts; //The optional parameters from the config file
 
-	//close the config file
-	fclose(configFile);
-	
-	//Open the log file
-	FILE *logFile;
-	logFile = fopen(logFileName, "a");
+	//The log file and the score log. They stay open for as long as the program runs
+	//and are rotated and compressed when they get too big or too old
+	struct logger logFile = {0};
+	struct logger scoreLog = {0};
+
+	//sets up the button structure, put what pins you want to use for the buttons
+	struct buttons butts;
+	butts.b1 = 17;
+	butts.b2 = 10;
+	butts.b3 = 11;
+
+	//sets up the LED structure, put whatever pins you want for the LEDs
+	struct ledPins LEDs;
+	LEDs.led11 = 4;
+	LEDs.led12 = 5;
+	LEDs.led13 = 6;
+	LEDs.led21 = 7;
+	LEDs.led22 = 8;
+	LEDs.led23 = 9;
 
-	//Log the config file event
-	PRINT_MSG(logFile, logTime, argv[0], "Configuration file read");
+	struct row song[MAX_ROWS]; //initializes the song
+	struct compiledChart chart; //the song as register masks, used by the game loop
+	int difficulty = EASY_SONG; //which song was picked, the backing track in practice mode depends on it
+	const char* songTracks[3] = {HOME_DIR "easySong.mp3", HOME_DIR "medSong.mp3", HOME_DIR "hardSong.mp3"};
+	struct backingTrack backing = {.playing = false, .ready = false}; //the stretched song audio in practice mode
+	struct arena session = {.base = NULL}; //the memory for the sound cues and the backing track, taken once at startup
+
+	GPIO_Handle gpio; //the GPIO registers
+	struct audioOutput audio = {0}; //the audio output, opened once and kept open
+	struct soundCue badCue; //the error sound, decoded once at startup
+	struct soundCue niceCue; //the nice sound, decoded once at startup
+
+	//The live game state, published in shared memory for spectator screens and monitors
+	struct gameState* liveState = NULL;
+	struct gameStatePayload live = {.phase = PHASE_STARTING};
+
+	//The song in progress is checkpointed at every interval, so a restarted game can resume it
+	struct checkpoint checkpoint = {.file = NULL};
+	struct checkpointRecord saved = {0}; //the newest checkpoint, which is resumed from at startup
+	bool resuming = false; //the next song carries on from saved instead of starting over
+
+	//Everything the game needs before the first song is set up by the startup pipeline. The
+	//independent steps (config, GPIO, audio device, sound cues, chart) run at the same time,
+	//and the audio device and sound cues finish while the game waits for input
+	struct startup boot = {.programName = programName, .LEDs = &LEDs, .butts = &butts,
+		.intervalTime = &INTERVAL_TIME, .timeoutTimer = &timeoutTimer, .MAX_INTERVALS = &MAX_INTERVALS,
+		.logFileName = logFileName, .badSoundPath = badSoundPath, .niceSoundPath = niceSoundPath,
+		.opts = &opts, .logFile = &logFile, .scoreLog = &scoreLog, .gpio = &gpio, .audio = &audio,
+		.badCue = &badCue, .niceCue = &niceCue, .song = song, .chart = &chart, .difficulty = &difficulty,
+		.arena = &session, .backing = &backing, .checkpoint = &checkpoint, .resume = &saved, .resuming = &resuming};
+
+	if (!runStartup(&boot, true))
+	{
+		if (boot.failed & FATAL_STEPS)
+		{
+			//Exit rather than play with what is missing, so the game is started again
+			finishStartup(&boot);
+			for (int step = 0; step < STEP_COUNT; step++)
+				if (boot.failed & FATAL_STEPS & AFTER(step))
+					fprintf(stderr, "The %s startup step failed\n", startupSteps[step].name);
+			if (!(boot.failed & AFTER(STEP_LOG)))
+			{
+				logStartupTimeline(&boot, &logFile, logTime, ~0u);
+				logClose(&logFile);
+				logClose(&scoreLog);
+			}
+			backingClose(&backing);
+			audioClose(&audio);
+			audioShutdown();
+			return 1;
+		}
+		fprintf(stderr, "Not every startup step succeeded, see the log\n");
+	}
+
+	//Log the config file event and how long each startup step took
+	LOG_MSG(&logFile, logTime, argName, "Configuration file read");
+	logStartupTimeline(&boot, &logFile, logTime, ~BACKGROUND_STEPS);
+
+	liveState = stateOpen(GAME_STATE_NAME);
+	if (liveState == NULL)
+		LOG_MSG(&logFile, logTime, argName, "The live game state could not be shared");
+	statePublish(liveState, &live);
 
 	//This variable will be used to access the /dev/watchdog file, similar to how
 	//the GPIO_Handle works
@@ -772,7 +3301,7 @@ int main (const int argc, const char* const argv[])
 		return -1;
 	} 
 	//Log that the watchdog file has been opened
-	PRINT_MSG(logFile, logTime, programName, "The Watchdog file has been opened\n\n");
+	LOG_MSG(&logFile, logTime, programName, "The Watchdog file has been opened\n\n");
 
 	//This line uses the ioctl function to set the time limit of the watchdog
 	//timer to 15 seconds. The time limit can not be set higher that 15 seconds
@@ -782,7 +3311,7 @@ int main (const int argc, const char* const argv[])
 	ioctl(watchdog, WDIOC_SETTIMEOUT, &timeoutTimer);
 	
 	//Log that the Watchdog time limit has been set
-	PRINT_MSG(logFile, logTime, programName, "The Watchdog time limit has been set\n\n");
+	LOG_MSG(&logFile, logTime, programName, "The Watchdog time limit has been set\n\n");
 
 	//The value of timeout will be changed to whatever the current time limit of the
 	//watchdog timer is
@@ -792,124 +3321,35 @@ int main (const int argc, const char* const argv[])
 	//changed. The \n will create a newline character similar to what endl does.
 	printf("The watchdog timeout is %d seconds.\n\n", timeoutTimer);*/
 
-	//sets up the button structure, put what pins you want to use for the buttons
-	struct buttons butts;
-	butts.b1 = 17;
-	butts.b2 = 10;
-	butts.b3 = 11;
-
-	//sets up the LED structure, put whatever pins you want for the LEDs
-	struct ledPins LEDs;
-	LEDs.led11 = 4;
-	LEDs.led12 = 5;
-	LEDs.led13 = 6;
-	LEDs.led21 = 7;
-	LEDs.led22 = 8;
-	LEDs.led23 = 9;
-
-	struct row song[60]; //initializes the song
-
-	//User always starts with the easy song upon boot
-	updateScore("‪/home/pi/score.log", 0, programName, logTime);
+	//Everything the songs share, kept from one song to the next
+	struct game game = {.programName = programName, .intervalTime = INTERVAL_TIME, .maxIntervals = MAX_INTERVALS,
+		.opts = &opts, .logFile = &logFile, .scoreLog = &scoreLog, .gpio = gpio, .LEDs = LEDs, .butts = butts,
+		.song = song, .chart = &chart, .difficulty = difficulty, .chartReady = true, .songTracks = songTracks,
+		.audio = &audio, .badCue = &badCue, .niceCue = &niceCue, .backing = &backing, .arena = &session,
+		.liveState = liveState, .live = &live, .checkpoint = &checkpoint, .saved = &saved, .resuming = resuming,
+		.boot = &boot, .pending = &boot, .pollUs = 3000, .clockMs = monotonicMs};
 
 	while (1) //runs the program infinitely
 	{
-		//initializes the pins
-		GPIO_Handle gpio = initializePins(LEDs);
-
-		//Log pin initialization
-		PRINT_MSG(logFile, logTime, argv[0], "GPIO pins initialized");
-
-		//Assign a song file based on the score (should be easySong since a score of 0 was assigned befoe the while loop)
-		assignSong(song, "/home/pi/score.log", MAX_INTERVALS); //assign a song ready to be played based on previous scores, uses the log file
-
-		//Turn off all lecs
-		setAllOff(gpio, LEDs);
-
-		logFile = fopen(logFileName, "a"); //log file is opened and ready to be written to
-		PRINT_MSG(logFile, logTime, argv[0], "Waiting for Input");
-		while (anythingPressed(butts, gpio)) //program does nothing until a button, any button is pressed
-		{
-			//This ioctl call will write to the watchdog file and prevent 
-			//the system from rebooting. It does this every 2 seconds, so 
-			//setting the watchdog timer lower than this will cause the timer
-			//to reset the Pi after 1 second
-			/*ioctl(watchdog, WDIOC_KEEPALIVE, 0);
-			//Log that the Watchdog was kicked
-			PRINT_MSG(logFile, logTime, programName, "The Watchdog was kicked\n\n");*/
-
-			usleep(500000);
-		}
-
-		int intervalCounter = 0; //counter used to run through song during the "song"
-		updateLEDs (LEDs, song, intervalCounter, gpio);
-		int correct = 0; //counts how many rows they got correct for highscore purposes
-		bool gotItRight = false; //used to determine outcome at the end of the time interval
-		time_t currentTime = time(NULL); //sets the currentTime of the program
-
-		PRINT_MSG(logFile, logTime, argv[0], "Game Comencing");
-
-		while (intervalCounter < MAX_INTERVALS) //loops until song is over
-		{
-
-			usleep(3000);
+		playSong(&game); //the first song was picked by the startup pipeline
+		finishedSong(gpio, LEDs); //flashes all LEDs too indicate song is over
 
-			if (ifStrummed(gpio)) //they strummed (broke) the laser, so we need to check buttons
-			{
-				PRINT_MSG(logFile, logTime, argv[0], "Laser Strummed");
-				if (intervalCounter > 0 && checkButtons(gpio, intervalCounter-1, butts, song)) //check if they are correct
-					gotItRight = true; //they were correct
-			}
-			if (time(NULL)-currentTime >= INTERVAL_TIME) //if the interval is over
-			{		
-				/*ioctl(watchdog, WDIOC_KEEPALIVE, 0);
-				PRINT_MSG(logFile, logTime, programName, "The Watchdog was kicked\n\n");*/
+		//Writing a V to the watchdog file will disable to watchdog and prevent it from
+		//resetting the system
+		/*write(watchdog, "V", 1);
+		//Log that the Watchdog was disabled
+		LOG_MSG(&logFile, logTime, programName, "The Watchdog was disabled\n\n");
 
-				if (gotItRight) //if they were correct
-				{
-					PRINT_MSG(logFile, logTime, argv[0], "Correct Response");
-					correct++; //increase their score
-					playSound(niceSoundPath); //play a rewarding sound
-				}
-				else //they were wrong
-				{
-					PRINT_MSG(logFile, logTime, argv[0], "Incorrect Response");
-					if (intervalCounter > 0) //if this is not the first interval, since there is a grace period
-						playSound(badSoundPath); //play that bad sound
-				}
-				gotItRight = false; //set false for next interval
-				intervalCounter++; //increase the row that we are on
-				updateLEDs (LEDs, song, intervalCounter, gpio); //update the LEDs
-				currentTime = time(NULL); //sets new current time
-			}
+		//Close the watchdog file so that it is not accidentally tampered with
+		close(watchdog);
+		//Log that the Watchdog was closed
+		LOG_MSG(&logFile, logTime, programName, "The Watchdog was closed\n\n");*/
 
-			
-		}	
-	updateScore("‪/home/pi/score.log", correct, programName, logTime);
-	PRINT_MSG(logFile, logTime, programName, "Song completed and score updated");
-	printf("Your score is: %d\n", correct);
-	fflush(stdout);
-	finishedSong(gpio, LEDs); //flashes all LEDs too indicate song is over
-
-	//Writing a V to the watchdog file will disable to watchdog and prevent it from
-	//resetting the system
-	/*write(watchdog, "V", 1);
-	//Log that the Watchdog was disabled
-	PRINT_MSG(logFile, logTime, programName, "The Watchdog was disabled\n\n");
-
-	//Close the watchdog file so that it is not accidentally tampered with
-	close(watchdog);
-	//Log that the Watchdog was closed
-	PRINT_MSG(logFile, logTime, programName, "The Watchdog was closed\n\n");*/
-
-	//Free the gpio pins
-	gpiolib_free_gpio(gpio);
-	//Log that the GPIO pins were freed
-	PRINT_MSG(logFile, logTime, programName, "The GPIO pins have been freed\n\n");
-	
-	fclose(logFile);
-	usleep(5000000); //dramatic pause before the entire thing happens again
+		usleep(5000000); //dramatic pause before the entire thing happens again
 	}
+	backingClose(&backing);
+	audioClose(&audio);
+	audioShutdown();
 	//Return to end the program
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1276 @@
+/*
+ * Benchmark suite for the Guitar Zero game core. It compiles GuitarZero.c against the
+ * in-memory register file in gpiolib_mock.h, so it runs on any Linux machine (no Pi needed).
+ *
+ * Build:  gcc -O2 -o GuitarZeroBench GuitarZeroBench.c -lao -lasound -lmpg123 -lz -lpthread -lrt -lm
+ * Usage:  ./GuitarZeroBench [--baseline FILE] [--save-baseline FILE] [--cue FILE.mp3] [--alsa DEVICE]
+ *
+ * --alsa plays the cue through the ALSA backend on DEVICE (e.g. null, or hw:Loopback,0 with
+ * snd-aloop loaded) and reports the measured output latency and underruns.
+ *
+ * Results are written to stdout as CSV, one line per benchmark. When a baseline file is
+ * given, every benchmark is compared against its stored time and per-benchmark budget and
+ * the program exits with 1 if any of them went over budget.
+ *
+ * Without --cue the sound cue is a short silent MP3 that the bench writes with its other
+ * fixtures, so the cue benchmarks always have something to decode and play. The baseline is
+ * recorded with that cue and the default output: with --cue the benchmarks that decode or
+ * play the cue, and with --alsa the steadyState check, are reported as not_compared, and a
+ * re-recorded baseline keeps their old times.
+ *
+ * The steadyState check plays whole songs with every heap allocation in the process counted
+ * (the bench replaces malloc and friends), and also makes the program exit with 1 if the
+ * game allocated anything after its first song. It plays the cues and a practice mode
+ * backing track through the default libao output, or through ALSA on DEVICE with --alsa.
+ *
+ * The compiledChartMatches check runs the compiled chart path and the original updateLEDs()
+ * and checkButtons() side by side on every pair of rows and every button pattern, and also
+ * makes the program exit with 1 if they ever disagree.
+ */
+
+#define GZ_MOCK_GPIO
+#define HOME_DIR "/tmp/GuitarZeroBench/"
+#define main guitarZeroMain
+#include "GuitarZero.c"
+#undef main
+
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+//Number of times each benchmark is repeated, the median repeat is reported
+#define REPEATS 5
+
+//Most samples a repeat can be split into (iterations / batch in the benchmark table)
+#define MAX_SAMPLES 5000
+
+//A benchmark is only over budget if it is also this many nanoseconds per operation over its
+//baseline, so the few nanosecond ones aren't failed by a slightly busier machine
+#define SLACK_NS 5.0
+
+//A benchmark that is over budget is measured again up to this many times, and only fails if
+//it is over every time. When the whole machine is busy for a few seconds every sample is slow
+#define RETRIES 2
+
+//Maximum number of benchmarks that can be stored in a baseline file
+#define MAX_BENCHMARKS 32
+
+//Number of diode polls the game loop does per interval in the simulated song
+#define POLLS_PER_INTERVAL 16
+
+//The chart length used for all of the chart benchmarks
+#define BENCH_INTERVALS 30
+
+//Length of the silent MP3 that is the sound cue when --cue isn't given, in MP3 frames
+//(1152 samples, about 26 ms each)
+#define FIXTURE_CUE_FRAMES 4
+
+//Length of the synthetic backing track the time stretch benchmarks use, in seconds
+#define BENCH_TRACK_SECONDS 10
+
+//Shared memory segment the game state benchmarks use, so a running game isn't disturbed
+#define BENCH_STATE_NAME "/GuitarZeroBenchState"
+
+//Number of reader threads hammering the segment in the contended write benchmark
+#define CONTENDING_READERS 3
+
+//glibc's own allocator, which the counting versions below hand every request on to
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+//While countAllocations is set every allocation in the process (the game's, the libraries'
+//and the C library's own) adds one to allocations
+static volatile int countAllocations;
+static long allocations;
+
+/*The test hook for the steady state check: these replace the C library's allocation
+functions for the whole program (glibc supports this) and count calls before allocating
+*/
+void* malloc(size_t size)
+{
+	if (countAllocations)
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+	if (countAllocations)
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	if (countAllocations)
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+	if (countAllocations)
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+	if (countAllocations)
+		__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_memalign(alignment, size);
+}
+
+/*A structure that describes one benchmark: its name, how many operations one run does, how
+many of them are timed together as one sample, the budget (in percent over the baseline) it
+is allowed, and the function that runs it. A run of the quick operations is split into
+samples of a few microseconds and its time is the median sample's, so being preempted
+spoils a sample rather than the run. The ones whose cost is paid now and then (log
+flushes, checkpoint syncs) or that set up threads or files first are timed as one sample
+*/
+struct benchmark
+{
+	const char* name;
+	long iterations;
+	long batch;
+	int budgetPct;
+	void (*run)(long iterations);
+};
+
+/*A structure for one line of the baseline file
+*/
+struct baselineEntry
+{
+	char name[50];
+	double nsPerOp;
+	int budgetPct;
+};
+
+//Shared state for the benchmarks, set up once in setUpFixtures()
+static GPIO_Handle benchGpio;
+static struct buttons benchButts = {17, 10, 11};
+static struct ledPins benchLEDs = {4, 5, 6, 7, 8, 9};
+static struct row benchSong[MAX_ROWS];
+static struct compiledChart benchChart;
+static struct soundCue benchTrack;
+static struct logger benchLog;
+static char benchCuePath[200];
+static char benchAlsaDevice[50];
+static bool benchOwnCue; //--cue gave the cue, instead of the fixture the baseline was recorded with
+static struct gameState* benchState;
+static struct arena benchArena;
+static struct options benchOpts;
+
+//Allocations counted in the last run of the steady state check
+static long steadyAllocations;
+
+//Differences found in the last run of the compiled chart check
+static long chartMismatches;
+
+//Extra information a benchmark can report in the note column of its result line
+static char benchNote[400];
+
+//Results are summed into this so the compiler can't throw the work away
+static volatile long sink;
+
+/*Returns the current value of the monotonic clock in nanoseconds
+*/
+static double nowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*Writes the string str to the file at path, returns false if the file couldn't be written
+*/
+static bool writeFixture(const char* path, const char* str)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return false;
+	fputs(str, file);
+	fclose(file);
+	return true;
+}
+
+/*Writes a short silent MP3 to path: MPEG-1 layer III frames at 128 kbps, 44.1 kHz stereo,
+with all of their side information zero so every granule decodes to silence. Returns false
+if the file couldn't be written
+*/
+static bool writeSilentMp3(const char* path)
+{
+	//A frame is the 4 byte header and 144 * 128000 / 44100 = 417 bytes in all (no padding)
+	unsigned char frame[417] = {0xFF, 0xFB, 0x90, 0x00};
+	bool ok = true;
+	FILE* file = fopen(path, "wb");
+
+	if (!file)
+		return false;
+	for (int i = 0; i < FIXTURE_CUE_FRAMES && ok; i++)
+		ok = fwrite(frame, sizeof(frame), 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
+
+/*Creates the scratch directory with a config file, a score log, the three song charts that
+the game expects to find in HOME_DIR and, unless --cue gave one, the sound cue
+*/
+static bool setUpFixtures(void)
+{
+	char chart[BENCH_INTERVALS*6 + 1];
+	char config[800];
+	int i = 0;
+
+	if (mkdir(HOME_DIR, 0755) != 0 && errno != EEXIST)
+		return false;
+
+	//Alternate through all 8 patterns so every branch in the LED and button code is hit
+	for (i = 0; i < BENCH_INTERVALS; i++)
+	{
+		chart[i*6 + 0] = '0' + ((i >> 0) & 1);
+		chart[i*6 + 1] = ' ';
+		chart[i*6 + 2] = '0' + ((i >> 1) & 1);
+		chart[i*6 + 3] = ' ';
+		chart[i*6 + 4] = '0' + ((i >> 2) & 1);
+		chart[i*6 + 5] = '\n';
+	}
+	chart[BENCH_INTERVALS*6] = '\0';
+
+	//Both sound cues (and the steady state check's backing track) are the --cue file, or
+	//the silent fixture if none was given
+	if (benchCuePath[0] == '\0')
+	{
+		if (!writeSilentMp3(HOME_DIR "cue.mp3"))
+			return false;
+		snprintf(benchCuePath, sizeof(benchCuePath), "%s", HOME_DIR "cue.mp3");
+	}
+	snprintf(config, sizeof(config),
+		"#Watchdog timeout in seconds\n"
+		"WATCHDOG_TIMEOUT = 15\n"
+		"#Seconds per interval\n"
+		"INTERVAL_TIME = 2\n"
+		"#Number of rows in a song\n"
+		"MAX_INTERVALS = 30\n"
+		"#Log file and sound cues\n"
+		"LOGFILE = " HOME_DIR "GuitarZero.log\n"
+		"BAD_SOUND = %s\n"
+		"NICE_SOUND = %s\n",
+		benchCuePath, benchCuePath);
+	if (!writeFixture(HOME_DIR "GuitarZero.cfg", config))
+		return false;
+
+	if (!writeFixture(HOME_DIR "score.log", "01-01-2026  00:00:00. : GuitarZero : 15\n\n"))
+		return false;
+
+	if (!writeFixture(HOME_DIR "easySong.log", chart) ||
+		!writeFixture(HOME_DIR "medSong.log", chart) ||
+		!writeFixture(HOME_DIR "hardSong.log", chart))
+		return false;
+
+	FILE* configFile = fopen(HOME_DIR "GuitarZero.cfg", "r");
+	if (!configFile)
+		return false;
+	readOptions(configFile, &benchOpts);
+	fclose(configFile);
+
+	benchGpio = gpiolib_init_gpio();
+	if (!benchGpio || !logOpen(&benchLog, HOME_DIR "GuitarZero.log", &benchOpts, benchOpts.logFlushBytes))
+		return false;
+	if (!arenaInit(&benchArena, benchOpts.arenaBytes))
+		return false;
+
+	assignSong(benchSong, HOME_DIR "score.log", BENCH_INTERVALS);
+	compileChart(&benchChart, benchSong, BENCH_INTERVALS, benchLEDs, benchButts);
+
+	benchState = stateOpen(BENCH_STATE_NAME);
+	if (!benchState)
+		return false;
+
+	//A chord with a beat on every half second, so there is something for WSOLA to line up
+	benchTrack.size = BENCH_TRACK_SECONDS * CUE_RATE * CUE_FRAME_BYTES;
+	benchTrack.pcm = (unsigned char*) malloc(benchTrack.size);
+	if (!benchTrack.pcm)
+		return false;
+	for (long frame = 0; frame < BENCH_TRACK_SECONDS * CUE_RATE; frame++)
+	{
+		double t = (double) frame / CUE_RATE;
+		double beat = exp(-8 * fmod(t, 0.5));
+		double left = sin(2 * M_PI * 220 * t) + 0.5 * sin(2 * M_PI * 277.2 * t) + 0.3 * sin(2 * M_PI * 329.6 * t);
+		double right = sin(2 * M_PI * 220 * t + 0.5) + 0.5 * sin(2 * M_PI * 440 * t);
+		((short*) benchTrack.pcm)[2*frame] = (short) (6000 * left * (0.4 + 0.6 * beat));
+		((short*) benchTrack.pcm)[2*frame + 1] = (short) (6000 * right * (0.4 + 0.6 * beat));
+	}
+	return true;
+}
+
+/*Parses the config file
+*/
+static void benchReadConfig(long iterations)
+{
+	char logFileName[MAX_PATH_LENGTH], badSoundPath[MAX_PATH_LENGTH], niceSoundPath[MAX_PATH_LENGTH];
+	int intervalTime, timeoutTimer, maxIntervals;
+	FILE* configFile = fopen(HOME_DIR "GuitarZero.cfg", "r");
+
+	for (long n = 0; n < iterations; n++)
+	{
+		rewind(configFile);
+		readConfig(configFile, logFileName, &intervalTime, &timeoutTimer, &maxIntervals, badSoundPath, niceSoundPath);
+		sink += maxIntervals;
+	}
+	fclose(configFile);
+}
+
+/*Looks up the previous score and loads the matching chart
+*/
+static void benchAssignSong(long iterations)
+{
+	struct row song[MAX_ROWS];
+
+	for (long n = 0; n < iterations; n++)
+	{
+		assignSong(song, HOME_DIR "score.log", BENCH_INTERVALS);
+		sink += song[BENCH_INTERVALS-1].status1;
+	}
+}
+
+/*Sets both LED rows for every interval of the chart
+*/
+static void benchUpdateLEDs(long iterations)
+{
+	for (long n = 0; n < iterations; n++)
+		updateLEDs(benchLEDs, benchSong, n % BENCH_INTERVALS, benchGpio);
+	sink += gpiolib_read_reg(benchGpio, GPLEV(0));
+}
+
+/*Judges the buttons against every row of the chart, with the buttons held in a pattern
+that is right for about half of the rows
+*/
+static void benchCheckButtons(long iterations)
+{
+	gpiolib_mock_set_level(benchGpio, benchButts.b1, 1);
+	gpiolib_mock_set_level(benchGpio, benchButts.b2, 0);
+	gpiolib_mock_set_level(benchGpio, benchButts.b3, 1);
+
+	for (long n = 0; n < iterations; n++)
+		sink += checkButtons(benchGpio, n % BENCH_INTERVALS, benchButts, benchSong);
+}
+
+/*updateLEDs for a compiled chart
+*/
+static void benchUpdateLEDsCompiled(long iterations)
+{
+	for (long n = 0; n < iterations; n++)
+		updateLEDsCompiled(&benchChart, n % BENCH_INTERVALS, benchGpio);
+	sink += gpiolib_read_reg(benchGpio, GPLEV(0));
+}
+
+/*checkButtons for a compiled chart, with the same button pattern as benchCheckButtons
+*/
+static void benchCheckButtonsCompiled(long iterations)
+{
+	gpiolib_mock_set_level(benchGpio, benchButts.b1, 1);
+	gpiolib_mock_set_level(benchGpio, benchButts.b2, 0);
+	gpiolib_mock_set_level(benchGpio, benchButts.b3, 1);
+
+	for (long n = 0; n < iterations; n++)
+		sink += checkButtonsCompiled(&benchChart, n % BENCH_INTERVALS, benchGpio);
+}
+
+/*Checks that the compiled chart path does exactly what updateLEDs and checkButtons do. Every
+pair of back and front row patterns is compiled as a two row chart, then the LED rows are set
+for each interval and every button pattern is judged, by both paths on two register files that
+start out the same. Each iteration checks every pair, and any difference fails the bench
+*/
+static void benchCompiledChartMatches(long iterations)
+{
+	GPIO_Mock legacy = {{0}};
+	GPIO_Mock compiled = {{0}};
+	struct row song[MAX_ROWS];
+	struct compiledChart chart;
+	//Start from all pins low, all high, and a mix, so every LED and button is seen both ways
+	const uint32_t starts[3] = {0, 0xffffffffu, 0x5a5a5a5au};
+	const int buttonPins[3] = {benchButts.b1, benchButts.b2, benchButts.b3};
+	long checks = 0;
+	long mismatches = 0;
+
+	for (long n = 0; n < iterations; n++)
+	{
+		for (int pair = 0; pair < 64; pair++)
+		{
+			memset(song, 0, sizeof(song));
+			song[0] = (struct row) {(pair >> 3) & 1, (pair >> 4) & 1, (pair >> 5) & 1};
+			song[1] = (struct row) {pair & 1, (pair >> 1) & 1, (pair >> 2) & 1};
+			compileChart(&chart, song, 2, benchLEDs, benchButts);
+
+			//Interval 2 is past the end, where the back row is blank (song[2] is zeroed)
+			for (int k = 0; k <= 2; k++)
+			{
+				for (int s = 0; s < 3; s++)
+				{
+					legacy.regs[GPLEV(0)] = compiled.regs[GPLEV(0)] = starts[s];
+					updateLEDs(benchLEDs, song, k, &legacy);
+					updateLEDsCompiled(&chart, k, &compiled);
+					mismatches += legacy.regs[GPLEV(0)] != compiled.regs[GPLEV(0)];
+					checks++;
+				}
+			}
+
+			for (int k = 0; k < 2; k++)
+			{
+				for (int held = 0; held < 8; held++)
+				{
+					for (int s = 0; s < 3; s++)
+					{
+						uint32_t level = starts[s];
+						for (int b = 0; b < 3; b++)
+						{
+							if (held & (1 << b))
+								level |= 1u << buttonPins[b];
+							else
+								level &= ~(1u << buttonPins[b]);
+						}
+						legacy.regs[GPLEV(0)] = compiled.regs[GPLEV(0)] = level;
+						mismatches += checkButtons(&legacy, k, benchButts, song) != checkButtonsCompiled(&chart, k, &compiled);
+						checks++;
+					}
+				}
+			}
+		}
+	}
+
+	chartMismatches = mismatches;
+	snprintf(benchNote, sizeof(benchNote), "%ld mismatches in %ld checks", mismatches, checks);
+}
+
+/*Writes log lines the same way the game loop does
+*/
+static void benchLogging(long iterations)
+{
+	char logTime[30];
+
+	for (long n = 0; n < iterations; n++)
+		LOG_MSG(&benchLog, logTime, "GuitarZero", "Laser Strummed");
+}
+
+/*Writes log lines as fast as possible into a log with small segments, so it rotates
+often, then waits for the compression thread. The note reports the write amplification:
+bytes that reach the card (the segments plus their compressed copies) per byte logged
+*/
+static void benchLogRotation(long iterations)
+{
+	char logTime[30];
+	struct logger log;
+	struct options opts = {.logMaxBytes = 64*1024, .logMaxAge = 24*60*60, .logMaxSegments = 4, .logFlushBytes = 4096};
+	long compressedBefore, rawBefore;
+
+	pthread_mutex_lock(&compressor.lock);
+	compressedBefore = compressor.bytesOut;
+	rawBefore = compressor.bytesIn;
+	pthread_mutex_unlock(&compressor.lock);
+
+	if (!logOpen(&log, HOME_DIR "rotation.log", &opts, opts.logFlushBytes))
+		return;
+	for (long n = 0; n < iterations; n++)
+		LOG_MSG(&log, logTime, "GuitarZero", (n & 1) ? "Correct Response" : "Laser Strummed");
+	logClose(&log);
+	waitForCompressor();
+
+	pthread_mutex_lock(&compressor.lock);
+	snprintf(benchNote, sizeof(benchNote), "write amplification %.3f (%ld segments; %ld flushes; %ld bytes compressed to %ld)",
+		(double) (log.bytesWritten + compressor.bytesOut - compressedBefore) / log.bytesWritten, log.rotations, log.flushes,
+		compressor.bytesIn - rawBefore, compressor.bytesOut - compressedBefore);
+	pthread_mutex_unlock(&compressor.lock);
+}
+
+/*Decodes the sound cue into memory, without playing it
+*/
+static void benchCueDecode(long iterations)
+{
+	struct soundCue cue;
+	size_t mark = arenaMark(&benchArena);
+
+	mpg123_init();
+	for (long n = 0; n < iterations; n++)
+	{
+		decodeSound(benchCuePath, &cue, &benchArena);
+		sink += cue.size;
+		arenaReset(&benchArena, mark);
+	}
+}
+
+/*Runs the startup pipeline, serially or in parallel, and then tears everything it set up
+back down. With resume set there is a checkpoint of a song half way through for it to pick
+up, otherwise there is no checkpoint file. The note has the time each step finished in the
+last run
+*/
+static void runStartupBench(long iterations, const bool parallel, const bool resume)
+{
+	int intervalTime, timeoutTimer, maxIntervals;
+	char logFileName[MAX_PATH_LENGTH], badSoundPath[MAX_PATH_LENGTH], niceSoundPath[MAX_PATH_LENGTH];
+	struct options opts;
+	struct logger logFile, scoreLog;
+	struct arena session;
+	struct backingTrack backing;
+	struct row song[MAX_ROWS];
+	struct compiledChart chart;
+	int difficulty;
+	GPIO_Handle gpio;
+	struct audioOutput audio;
+	struct soundCue badCue, niceCue;
+	struct checkpoint checkpoint;
+	struct checkpointRecord saved = {0};
+	bool resuming = false;
+	int length = 0;
+
+	unlink(HOME_DIR "checkpoint.bin");
+	if (resume)
+	{
+		saved = (struct checkpointRecord) {.epoch = 7, .chartId = chartId(benchSong, BENCH_INTERVALS),
+			.difficulty = MEDIUM_SONG, .intervalCounter = BENCH_INTERVALS / 2, .correct = 9,
+			.maxIntervals = BENCH_INTERVALS, .active = true};
+		if (checkpointOpen(&checkpoint, HOME_DIR "checkpoint.bin", false))
+		{
+			checkpointSave(&checkpoint, &saved);
+			checkpointClose(&checkpoint);
+		}
+	}
+
+	for (long n = 0; n < iterations; n++)
+	{
+		struct startup boot = {.programName = "GuitarZero", .LEDs = &benchLEDs, .butts = &benchButts,
+			.intervalTime = &intervalTime, .timeoutTimer = &timeoutTimer, .MAX_INTERVALS = &maxIntervals,
+			.logFileName = logFileName, .badSoundPath = badSoundPath, .niceSoundPath = niceSoundPath,
+			.opts = &opts, .logFile = &logFile, .scoreLog = &scoreLog, .gpio = &gpio, .audio = &audio,
+			.badCue = &badCue, .niceCue = &niceCue, .song = song, .chart = &chart, .difficulty = &difficulty,
+			.arena = &session, .backing = &backing, .checkpoint = &checkpoint, .resume = &saved, .resuming = &resuming};
+
+		memset(&session, 0, sizeof(session));
+		memset(&backing, 0, sizeof(backing));
+		memset(&logFile, 0, sizeof(logFile));
+		memset(&scoreLog, 0, sizeof(scoreLog));
+		gpio = NULL;
+		memset(&audio, 0, sizeof(audio));
+		memset(&checkpoint, 0, sizeof(checkpoint));
+		badCue.pcm = niceCue.pcm = NULL;
+
+		runStartup(&boot, parallel);
+		finishStartup(&boot);
+
+		if (n == iterations - 1)
+		{
+			length = 0;
+			for (int step = 0; step < STEP_COUNT && length < (int) sizeof(benchNote); step++)
+				length += snprintf(benchNote + length, sizeof(benchNote) - length, "%s%s %.2f ms%s",
+					step ? "; " : "", startupSteps[step].name, boot.stepEnd[step], (boot.failed & AFTER(step)) ? " failed" : "");
+			if (resume && length < (int) sizeof(benchNote))
+				snprintf(benchNote + length, sizeof(benchNote) - length, resuming ? "; resumed at interval %d" : "; not resumed",
+					saved.intervalCounter);
+		}
+
+		logClose(&logFile);
+		logClose(&scoreLog);
+		if (gpio)
+			gpiolib_free_gpio(gpio);
+		audioClose(&audio);
+		backingClose(&backing);
+		checkpointClose(&checkpoint);
+		if (session.base)
+			arenaFree(&session);
+	}
+	unlink(HOME_DIR "checkpoint.bin");
+}
+
+static void benchStartupSerial(long iterations)
+{
+	runStartupBench(iterations, false, false);
+}
+
+static void benchStartupParallel(long iterations)
+{
+	runStartupBench(iterations, true, false);
+}
+
+/*The restart to resume latency: the game carries on with a resumed song as soon as the
+startup pipeline is done
+*/
+static void benchStartupResume(long iterations)
+{
+	runStartupBench(iterations, true, true);
+}
+
+/*Writes a checkpoint for every interval of a song, as the game loop does. With sync set
+each one is also handed to the flushing thread, and the note has what the flushes cost it
+*/
+static void runCheckpointBench(long iterations, const bool sync)
+{
+	struct checkpoint cp;
+	struct checkpointRecord saved = {.epoch = 1, .chartId = chartId(benchSong, BENCH_INTERVALS),
+		.maxIntervals = BENCH_INTERVALS, .active = true};
+
+	if (!checkpointOpen(&cp, HOME_DIR "benchCheckpoint.bin", sync))
+		return;
+	for (long n = 0; n < iterations; n++)
+	{
+		saved.intervalCounter = n % BENCH_INTERVALS;
+		saved.correct = saved.intervalCounter / 2;
+		checkpointSave(&cp, &saved);
+	}
+	checkpointClose(&cp);
+	if (sync)
+		snprintf(benchNote, sizeof(benchNote), "%ld flushes for %ld checkpoints, %.3f ms each",
+			cp.syncs, iterations, cp.syncs ? cp.syncUs / 1000.0 / cp.syncs : 0.0);
+}
+
+static void benchCheckpoint(long iterations)
+{
+	runCheckpointBench(iterations, false);
+}
+
+static void benchCheckpointSynced(long iterations)
+{
+	runCheckpointBench(iterations, true);
+}
+
+/*Plays the --cue file through the ALSA backend on the --alsa device, once with mmap and
+once with snd_pcm_writei on alternate iterations. The note has the latency and underruns
+*/
+static void benchAlsaCue(long iterations)
+{
+	struct options opts;
+	struct audioOutput mmapOut, writeOut;
+	struct soundCue cue;
+	size_t mark = arenaMark(&benchArena);
+	char mmapLine[150], writeLine[150];
+	FILE* configFile = fopen(HOME_DIR "GuitarZero.cfg", "r");
+
+	if (!configFile)
+		return;
+	readOptions(configFile, &opts);
+	fclose(configFile);
+	opts.audioBackend = AUDIO_ALSA;
+	snprintf(opts.alsaDevice, sizeof(opts.alsaDevice), "%s", benchAlsaDevice);
+
+	mpg123_init();
+	if (!decodeSound(benchCuePath, &cue, &benchArena))
+		return;
+
+	opts.alsaMmap = 1;
+	if (!audioOpen(&mmapOut, &opts))
+		return;
+	opts.alsaMmap = 0;
+	if (!audioOpen(&writeOut, &opts))
+	{
+		audioClose(&mmapOut);
+		return;
+	}
+
+	for (long n = 0; n < iterations; n++)
+		playCue((n & 1) ? &writeOut : &mmapOut, &cue);
+
+	audioStats(&mmapOut, mmapLine, sizeof(mmapLine));
+	audioStats(&writeOut, writeLine, sizeof(writeLine));
+	snprintf(benchNote, sizeof(benchNote), "%s; %s", mmapLine, writeLine);
+	for (char* c = benchNote; *c; c++)
+	{
+		//Keep the note in one CSV field
+		if (*c == ',')
+			*c = ';';
+	}
+
+	audioClose(&mmapOut);
+	audioClose(&writeOut);
+	arenaReset(&benchArena, mark);
+}
+
+/*Time stretches the synthetic track at speed percent until iterations seconds of output
+have been made, starting over at the end of the track. The note has the real-time factor
+(processing time per second of audio, on one core)
+*/
+static void runStretchBench(long iterations, const int speed)
+{
+	struct stretcher st;
+	short out[STRETCH_HOP * CUE_CHANNELS];
+	long produced = 0;
+	double start = nowNs();
+	double seconds;
+	size_t mark = arenaMark(&benchArena);
+
+	if (!stretchInit(&st, &benchTrack, speed / 100.0, &benchArena))
+		return;
+	while (produced < iterations * CUE_RATE)
+	{
+		int frames = stretchStep(&st, out);
+		if (frames == 0)
+		{
+			arenaReset(&benchArena, mark);
+			stretchInit(&st, &benchTrack, speed / 100.0, &benchArena);
+			continue;
+		}
+		produced += frames;
+		sink += out[0];
+	}
+	arenaReset(&benchArena, mark);
+
+	seconds = (nowNs() - start) / 1e9;
+	snprintf(benchNote, sizeof(benchNote), "real-time factor %.4f per core (%.0fx faster than real time)",
+		seconds / iterations, iterations / seconds);
+}
+
+static void benchStretch50(long iterations)
+{
+	runStretchBench(iterations, 50);
+}
+
+static void benchStretch75(long iterations)
+{
+	runStretchBench(iterations, 75);
+}
+
+static void benchStretch125(long iterations)
+{
+	runStretchBench(iterations, 125);
+}
+
+static void benchStretch150(long iterations)
+{
+	runStretchBench(iterations, 150);
+}
+
+/*Plays through a whole song the way the main loop does, without the sleeps and the
+sounds. The strum and button levels change from interval to interval
+*/
+static void benchSimulatedSong(long iterations)
+{
+	char logTime[30];
+
+	for (long n = 0; n < iterations; n++)
+	{
+		int intervalCounter = 0;
+		int correct = 0;
+		bool gotItRight = false;
+
+		updateLEDsCompiled(&benchChart, intervalCounter, benchGpio);
+		while (intervalCounter < BENCH_INTERVALS)
+		{
+			for (int poll = 0; poll < POLLS_PER_INTERVAL; poll++)
+			{
+				//The diode is active low, break the laser on the last few polls
+				gpiolib_mock_set_level(benchGpio, DIODEPIN, poll < POLLS_PER_INTERVAL - 2);
+				if (ifStrummed(benchGpio))
+				{
+					LOG_MSG(&benchLog, logTime, "GuitarZero", "Laser Strummed");
+					if (intervalCounter > 0 && checkButtonsCompiled(&benchChart, intervalCounter-1, benchGpio))
+						gotItRight = true;
+				}
+			}
+
+			if (gotItRight)
+			{
+				LOG_MSG(&benchLog, logTime, "GuitarZero", "Correct Response");
+				correct++;
+			}
+			else
+				LOG_MSG(&benchLog, logTime, "GuitarZero", "Incorrect Response");
+
+			gotItRight = false;
+			intervalCounter++;
+			gpiolib_mock_set_level(benchGpio, benchButts.b1, intervalCounter & 1);
+			gpiolib_mock_set_level(benchGpio, benchButts.b2, intervalCounter & 2);
+			updateLEDsCompiled(&benchChart, intervalCounter, benchGpio);
+		}
+		sink += correct;
+	}
+}
+
+/*A structure for the threads that contend for the game state: they run until stop is set
+and count what they did in operations and retries
+*/
+struct stateContender
+{
+	pthread_t thread;
+	volatile int stop;
+	long operations;
+	long retries;
+};
+
+/*Reads the game state as fast as possible, the way a badly behaved monitor would
+*/
+static void* stateReaderThread(void* arg)
+{
+	struct stateContender* c = arg;
+	struct gameStatePayload snapshot;
+
+	while (!c->stop)
+	{
+		c->retries += gameStateRead(benchState, &snapshot);
+		c->operations++;
+	}
+	return NULL;
+}
+
+/*Publishes the game state as fast as possible, far more often than the game does
+*/
+static void* stateWriterThread(void* arg)
+{
+	struct stateContender* c = arg;
+	struct gameStatePayload live = {.phase = PHASE_PLAYING, .maxIntervals = BENCH_INTERVALS};
+
+	while (!c->stop)
+	{
+		live.intervalCounter = c->operations % BENCH_INTERVALS;
+		stateRows(&live, benchSong, live.intervalCounter, BENCH_INTERVALS);
+		statePublish(benchState, &live);
+		c->operations++;
+	}
+	return NULL;
+}
+
+/*Publishes one interval's worth of state the way the game loop does at an interval boundary
+*/
+static void publishIntervals(long iterations)
+{
+	struct gameStatePayload live = {.phase = PHASE_PLAYING, .maxIntervals = BENCH_INTERVALS};
+
+	for (long n = 0; n < iterations; n++)
+	{
+		live.intervalCounter = n % BENCH_INTERVALS;
+		live.correct = n & 15;
+		live.lastJudgement = (n & 1) ? JUDGEMENT_CORRECT : JUDGEMENT_INCORRECT;
+		stateRows(&live, benchSong, live.intervalCounter, BENCH_INTERVALS);
+		statePublish(benchState, &live);
+	}
+	sink += live.updates;
+}
+
+static void benchStateWrite(long iterations)
+{
+	publishIntervals(iterations);
+}
+
+/*Publishes while CONTENDING_READERS threads read the segment in a tight loop. The note has
+how many snapshots the readers got and how often they had to retry
+*/
+static void benchStateWriteContended(long iterations)
+{
+	struct stateContender readers[CONTENDING_READERS] = {0};
+	long reads = 0, retries = 0;
+
+	for (int i = 0; i < CONTENDING_READERS; i++)
+		pthread_create(&readers[i].thread, NULL, stateReaderThread, &readers[i]);
+	publishIntervals(iterations);
+	for (int i = 0; i < CONTENDING_READERS; i++)
+	{
+		readers[i].stop = 1;
+		pthread_join(readers[i].thread, NULL);
+		reads += readers[i].operations;
+		retries += readers[i].retries;
+	}
+
+	snprintf(benchNote, sizeof(benchNote), "%d readers took %ld snapshots (%.3f retries per snapshot)",
+		CONTENDING_READERS, reads, reads ? (double) retries / reads : 0.0);
+}
+
+/*Reads snapshots with nobody writing
+*/
+static void benchStateRead(long iterations)
+{
+	struct gameStatePayload snapshot;
+
+	for (long n = 0; n < iterations; n++)
+	{
+		gameStateRead(benchState, &snapshot);
+		sink += snapshot.intervalCounter;
+	}
+}
+
+/*Reads snapshots while a writer thread publishes in a tight loop. The note has how often a
+read had to retry
+*/
+static void benchStateReadContended(long iterations)
+{
+	struct stateContender writer = {0};
+	struct gameStatePayload snapshot;
+	long retries = 0;
+
+	pthread_create(&writer.thread, NULL, stateWriterThread, &writer);
+	for (long n = 0; n < iterations; n++)
+	{
+		retries += gameStateRead(benchState, &snapshot);
+		sink += snapshot.intervalCounter;
+	}
+	writer.stop = 1;
+	pthread_join(writer.thread, NULL);
+
+	snprintf(benchNote, sizeof(benchNote), "writer published %ld times (%.3f retries per snapshot)",
+		writer.operations, (double) retries / iterations);
+}
+
+static long long benchNow; //the steady state check's clock, in milliseconds
+static long long benchPollMs; //how far the clock moves on each read
+
+/*The clock the steady state check plays its songs with. Every read moves it on by about one
+poll of the laser, and the player keeps time with it: the laser is broken for all but the last
+two polls of an interval and the held buttons change every interval
+*/
+static long long benchClockMs (void)
+{
+	benchNow += benchPollMs;
+	long long poll = benchNow / benchPollMs;
+	gpiolib_mock_set_level(benchGpio, DIODEPIN, poll % POLLS_PER_INTERVAL < POLLS_PER_INTERVAL - 2);
+	gpiolib_mock_set_level(benchGpio, benchButts.b1, poll / POLLS_PER_INTERVAL & 1);
+	gpiolib_mock_set_level(benchGpio, benchButts.b2, poll / POLLS_PER_INTERVAL & 2);
+	return benchNow;
+}
+
+/*Plays one whole song through the game's own playSong, from picking the song to logging the
+score, with the buttons let go first so it doesn't wait for them
+*/
+static void playSteadyStateSong (struct game* game)
+{
+	gpiolib_mock_set_level(benchGpio, benchButts.b1, 1);
+	gpiolib_mock_set_level(benchGpio, benchButts.b2, 1);
+	gpiolib_mock_set_level(benchGpio, benchButts.b3, 1);
+	sink += playSong(game);
+	setAllOn(benchGpio, benchLEDs);
+	setAllOff(benchGpio, benchLEDs);
+}
+
+/*The steady state check: after one song to warm up (the C library sets some things up the
+first time they are used), plays iterations more songs with every allocation counted. The
+game should allocate nothing once it is running, so any allocation fails the check
+*/
+static void benchSteadyState(long iterations)
+{
+	struct logger songLog = {0};
+	struct logger scoreLog = {0};
+	struct audioOutput audio = {0};
+	struct soundCue cue = {NULL, 0};
+	struct backingTrack backing = {.ready = false};
+	struct gameStatePayload live = {.phase = PHASE_STARTING};
+	struct options opts = benchOpts;
+	struct checkpoint cp;
+	struct checkpointRecord saved = {0};
+	const char* tracks[3] = {benchCuePath, benchCuePath, benchCuePath};
+	size_t mark = arenaMark(&benchArena);
+
+	//A log of its own, so the other benchmarks' logging can't make it rotate mid check
+	logOpen(&songLog, HOME_DIR "steadyState.log", &opts, opts.logFlushBytes);
+	logOpen(&scoreLog, HOME_DIR "score.log", &opts, 0);
+	checkpointOpen(&cp, HOME_DIR "steadyCheckpoint.bin", opts.checkpointSync);
+
+	//The cues and the backing track go to the same output as the game's, unless --alsa
+	//picked a device
+	if (benchAlsaDevice[0])
+	{
+		opts.audioBackend = AUDIO_ALSA;
+		snprintf(opts.alsaDevice, sizeof(opts.alsaDevice), "%s", benchAlsaDevice);
+	}
+	mpg123_init();
+	if (audioOpen(&audio, &opts))
+		decodeSound(benchCuePath, &cue, &benchArena);
+	backingOpen(&backing, &benchArena, &opts);
+
+	//Practice mode at 75%, so the backing track is played too
+	opts.practiceSpeed = 75;
+	struct game game = {.programName = "GuitarZero", .intervalTime = 1, .maxIntervals = BENCH_INTERVALS,
+		.opts = &opts, .logFile = &songLog, .scoreLog = &scoreLog, .gpio = benchGpio, .LEDs = benchLEDs,
+		.butts = benchButts, .song = benchSong, .chart = &benchChart, .songTracks = tracks, .audio = &audio,
+		.badCue = &cue, .niceCue = &cue, .backing = &backing, .arena = &benchArena, .liveState = benchState,
+		.live = &live, .checkpoint = &cp, .saved = &saved, .pollUs = 0, .clockMs = benchClockMs};
+	benchPollMs = 1000 * 100 / opts.practiceSpeed / POLLS_PER_INTERVAL + 1;
+
+	playSteadyStateSong(&game);
+
+	allocations = 0;
+	countAllocations = 1;
+	for (long n = 0; n < iterations; n++)
+		playSteadyStateSong(&game);
+	countAllocations = 0;
+	steadyAllocations = allocations;
+
+	snprintf(benchNote, sizeof(benchNote), "%ld allocations in %ld songs (cues %s; backing track %s)",
+		steadyAllocations, iterations, cue.pcm ? "played" : "skipped", backing.ready ? "played" : "skipped");
+
+	backingClose(&backing);
+	audioClose(&audio);
+	checkpointClose(&cp);
+	arenaReset(&benchArena, mark);
+	logClose(&songLog);
+	logClose(&scoreLog);
+}
+
+//The benchmark table, in the order they are run
+static const struct benchmark benchmarks[] =
+{
+	{"readConfig", 20000, 100, 50, benchReadConfig},
+	{"assignSong", 5000, 10, 50, benchAssignSong},
+	{"updateLEDs", 5000000, 1000, 50, benchUpdateLEDs},
+	{"checkButtons", 5000000, 1000, 50, benchCheckButtons},
+	{"updateLEDsCompiled", 5000000, 1000, 50, benchUpdateLEDsCompiled},
+	{"checkButtonsCompiled", 5000000, 1000, 50, benchCheckButtonsCompiled},
+	{"compiledChartMatches", 200, 200, 50, benchCompiledChartMatches},
+	{"logging", 20000, 20000, 50, benchLogging},
+	{"logRotation", 100000, 100000, 50, benchLogRotation},
+	{"cueDecode", 20, 20, 50, benchCueDecode},
+	{"alsaCue", 4, 4, 25, benchAlsaCue},
+	{"stretch50", 20, 20, 50, benchStretch50},
+	{"stretch75", 20, 20, 50, benchStretch75},
+	{"stretch125", 20, 20, 50, benchStretch125},
+	{"stretch150", 20, 20, 50, benchStretch150},
+	{"startupSerial", 50, 50, 50, benchStartupSerial},
+	{"startupParallel", 50, 50, 100, benchStartupParallel},
+	{"startupResume", 50, 50, 100, benchStartupResume},
+	{"checkpoint", 2000000, 2000000, 50, benchCheckpoint},
+	{"checkpointSynced", 20000, 20000, 100, benchCheckpointSynced},
+	{"stateWrite", 5000000, 1000, 50, benchStateWrite},
+	{"stateWriteContended", 2000000, 2000000, 100, benchStateWriteContended},
+	{"stateRead", 5000000, 1000, 50, benchStateRead},
+	{"stateReadContended", 2000000, 2000000, 100, benchStateReadContended},
+	{"simulatedSong", 200, 200, 60, benchSimulatedSong},
+	{"steadyState", 3, 3, 100, benchSteadyState},
+};
+
+/*Reads a baseline file with lines of the form "name nsPerOp budgetPct" into entries.
+Lines starting with '#' are comments. Returns the number of entries read, or -1 if the
+file couldn't be opened
+*/
+static int readBaseline(const char* path, struct baselineEntry* entries)
+{
+	char buffer[200];
+	int count = 0;
+	FILE* file = fopen(path, "r");
+
+	if (!file)
+		return -1;
+
+	while (count < MAX_BENCHMARKS && fgets(buffer, sizeof(buffer), file) != NULL)
+	{
+		if (buffer[0] == '#')
+			continue;
+		if (sscanf(buffer, "%49s %lf %d", entries[count].name, &entries[count].nsPerOp, &entries[count].budgetPct) == 3)
+			count++;
+	}
+	fclose(file);
+	return count;
+}
+
+/*Orders two doubles for qsort
+*/
+static int compareDoubles(const void* a, const void* b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+/*Returns the median of the count values, which are sorted in place
+*/
+static double median(double* values, const int count)
+{
+	qsort(values, count, sizeof(double), compareDoubles);
+	return count % 2 ? values[count/2] : (values[count/2 - 1] + values[count/2]) / 2;
+}
+
+/*Runs a benchmark: warms up the caches once, then times each repeat in samples of batch
+operations. Returns the median repeat's time per operation in nanoseconds
+*/
+static double measure(const struct benchmark* bench)
+{
+	double repeats[REPEATS];
+	static double samples[MAX_SAMPLES];
+	const int sampleCount = bench->iterations / bench->batch;
+
+	bench->run(bench->iterations / 10 + 1);
+	for (int r = 0; r < REPEATS; r++)
+	{
+		for (int s = 0; s < sampleCount; s++)
+		{
+			double start = nowNs();
+			bench->run(bench->batch);
+			samples[s] = (nowNs() - start) / bench->batch;
+		}
+		repeats[r] = median(samples, sampleCount);
+	}
+	return median(repeats, REPEATS);
+}
+
+/*Returns true if nsPerOp is more than base's budget and SLACK_NS over its time
+*/
+static bool overBudget(const double nsPerOp, const struct baselineEntry* base)
+{
+	return nsPerOp > base->nsPerOp * (100 + base->budgetPct) / 100 && nsPerOp > base->nsPerOp + SLACK_NS;
+}
+
+/*Returns the baseline entry with the given name, or NULL if there isn't one
+*/
+static const struct baselineEntry* findBaseline(const struct baselineEntry* entries, int count, const char* name)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (strcmp(entries[i].name, name) == 0)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+/*Returns true if the benchmark's time can be compared with the baseline, which is recorded
+with the fixture cue and (but for alsaCue) the default audio output. The benchmarks that
+decode or play a cue given with --cue can't be, and neither can the steady state check
+when --alsa makes it play its cues in real time
+*/
+static bool comparable(const struct benchmark* bench)
+{
+	if (benchOwnCue && (bench->run == benchCueDecode || bench->run == benchAlsaCue || bench->run == benchSteadyState ||
+		bench->run == benchStartupSerial || bench->run == benchStartupParallel || bench->run == benchStartupResume))
+		return false;
+	return !(benchAlsaDevice[0] && bench->run == benchSteadyState);
+}
+
+int main (const int argc, const char* const argv[])
+{
+	const char* baselinePath = NULL;
+	const char* saveBaselinePath = NULL;
+	struct baselineEntry baseline[MAX_BENCHMARKS];
+	int baselineCount = 0;
+	int failures = 0;
+	FILE* results;
+	FILE* saveFile = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if (strcmp(argv[i], "--save-baseline") == 0 && i + 1 < argc)
+			saveBaselinePath = argv[++i];
+		else if (strcmp(argv[i], "--cue") == 0 && i + 1 < argc)
+		{
+			snprintf(benchCuePath, sizeof(benchCuePath), "%s", argv[++i]);
+			benchOwnCue = true;
+		}
+		else if (strcmp(argv[i], "--alsa") == 0 && i + 1 < argc)
+			snprintf(benchAlsaDevice, sizeof(benchAlsaDevice), "%s", argv[++i]);
+		else
+		{
+			fprintf(stderr, "Usage: %s [--baseline FILE] [--save-baseline FILE] [--cue FILE.mp3] [--alsa DEVICE]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (baselinePath && (baselineCount = readBaseline(baselinePath, baseline)) < 0)
+	{
+		perror("The baseline file could not be opened");
+		return 2;
+	}
+
+	//A re-recorded baseline keeps the budgets (and the times it can't measure) of the one it
+	//replaces, which is a new file if there isn't one yet
+	if (saveBaselinePath && !baselinePath && (baselineCount = readBaseline(saveBaselinePath, baseline)) < 0)
+		baselineCount = 0;
+
+	//The game code prints to stdout, so keep the real stdout for the results and
+	//send everything else to /dev/null
+	results = fdopen(dup(STDOUT_FILENO), "w");
+	if (!results || !freopen("/dev/null", "w", stdout))
+	{
+		perror("Could not redirect stdout");
+		return 2;
+	}
+
+	if (!setUpFixtures())
+	{
+		perror("Could not create the benchmark fixtures in " HOME_DIR);
+		return 2;
+	}
+
+	if (saveBaselinePath && !(saveFile = fopen(saveBaselinePath, "w")))
+	{
+		perror("The baseline file could not be written");
+		return 2;
+	}
+	if (saveFile)
+		fprintf(saveFile, "#name nsPerOp budgetPct\n");
+
+	fprintf(results, "benchmark,iterations,ns_per_op,baseline_ns_per_op,budget_pct,status,note\n");
+
+	for (size_t b = 0; b < sizeof(benchmarks)/sizeof(benchmarks[0]); b++)
+	{
+		const struct benchmark* bench = &benchmarks[b];
+		const struct baselineEntry* old = findBaseline(baseline, baselineCount, bench->name);
+		const struct baselineEntry* base = baselinePath ? old : NULL; //what the time is compared with
+		double nsPerOp;
+		const char* status = "ok";
+
+		//The ALSA cue benchmark needs a device, skip it when none was given. A baseline
+		//that is re-recorded keeps its old time
+		if (bench->run == benchAlsaCue && benchAlsaDevice[0] == '\0')
+		{
+			fprintf(results, "%s,0,,,,skipped,\n", bench->name);
+			if (saveFile && old)
+				fprintf(saveFile, "%s %.1f %d\n", old->name, old->nsPerOp, old->budgetPct);
+			continue;
+		}
+
+		benchNote[0] = '\0';
+		nsPerOp = measure(bench);
+
+		//The steady state check fails on any allocation, however fast it was
+		if (bench->run == benchSteadyState && steadyAllocations > 0)
+		{
+			status = "allocates";
+			failures++;
+		}
+
+		//And the compiled chart check on any difference from the original functions
+		if (bench->run == benchCompiledChartMatches && chartMismatches > 0)
+		{
+			status = "mismatch";
+			failures++;
+		}
+
+		if (base && comparable(bench))
+		{
+			//The fastest attempt is kept
+			for (int retry = 0; retry < RETRIES && overBudget(nsPerOp, base); retry++)
+			{
+				double again = measure(bench);
+				if (again < nsPerOp)
+					nsPerOp = again;
+			}
+			if (overBudget(nsPerOp, base))
+			{
+				status = "over_budget";
+				failures++;
+			}
+			fprintf(results, "%s,%ld,%.1f,%.1f,%d,%s,%s\n", bench->name, bench->iterations, nsPerOp, base->nsPerOp, base->budgetPct, status, benchNote);
+		}
+		else
+		{
+			if (baselinePath && strcmp(status, "ok") == 0)
+				status = comparable(bench) ? "no_baseline" : "not_compared";
+			fprintf(results, "%s,%ld,%.1f,,,%s,%s\n", bench->name, bench->iterations, nsPerOp, status, benchNote);
+		}
+		fflush(results);
+
+		//Keep the existing budget when a baseline is re-recorded, and the existing time as
+		//well if this one can't be compared with it
+		if (saveFile && comparable(bench))
+			fprintf(saveFile, "%s %.1f %d\n", bench->name, nsPerOp, old ? old->budgetPct : bench->budgetPct);
+		else if (saveFile && old)
+			fprintf(saveFile, "%s %.1f %d\n", old->name, old->nsPerOp, old->budgetPct);
+	}
+
+	if (saveFile)
+		fclose(saveFile);
+	gpiolib_free_gpio(benchGpio);
+	arenaFree(&benchArena);
+	stateClose(benchState);
+	shm_unlink(BENCH_STATE_NAME);
+	logClose(&benchLog);
+	free(benchTrack.pcm);
+	audioShutdown();
+	fclose(results);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,965 @@
+/*
+ * Offline chart authoring tool for Guitar Zero. It decodes MP3s, finds the note onsets and
+ * the tempo from the spectral flux (how much the spectrum grows from one short window to
+ * the next), and writes a chart of "0 1 0" rows at a chosen difficulty for each song. A
+ * whole music library can be given at once and the songs are shared out over all cores.
+ *
+ * Build:  gcc -O3 -o GuitarZeroChart GuitarZeroChart.c -lmpg123 -lpthread -lm
+ * Usage:  ./GuitarZeroChart [--difficulty easy|medium|hard|all] [--interval SECONDS] [--rows N]
+ *                           [--threads N] [--out DIRECTORY] FILE.mp3|DIRECTORY...
+ *         ./GuitarZeroChart --self-test
+ *
+ * Each chart is written as NAME.easy.log, NAME.medium.log or NAME.hard.log (next to the song,
+ * or in --out), ready to be copied over easySong.log, medSong.log or hardSong.log. --interval
+ * and --rows should match INTERVAL_TIME and MAX_INTERVALS in GuitarZero.cfg. One CSV line per
+ * song is written to stdout, and the songs per minute for the whole run to stderr.
+ *
+ * --self-test checks the FFT against a plain DFT and the onsets and tempo found in click
+ * tracks of known tempo, prints one CSV line per check and exits with 1 if any failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>		//for strcasecmp()
+#include <math.h>
+#include <time.h>
+#include <unistd.h>		//for sysconf()
+#include <dirent.h>		//for reading a music library directory
+#include <sys/stat.h>
+#include <pthread.h>
+#include <mpg123.h>
+
+#define true 1
+#define false 0
+typedef int bool;
+
+//Songs are analysed as mono at this rate, mpg123 resamples and mixes down to it
+#define RATE 44100
+
+//Spectral frames: 1024 samples (23 ms) every 512 samples (11.6 ms)
+#define FFT_SIZE 1024
+#define FFT_HOP 512
+#define BINS (FFT_SIZE/2)
+#define FRAMES_PER_SECOND ((double) RATE / FFT_HOP)
+
+//The bins (43 Hz each) that make up the three lanes, from low to high: bass and kick up to
+//340 Hz, then up to 2 kHz, then up to 8.3 kHz. Each boundary is a multiple of 4 for SIMD
+#define LOW_BINS 8
+#define MID_BINS 48
+#define HIGH_BINS 192
+#define LANES 3
+
+//Onset picking: a peak must be the largest flux within ONSET_SPREAD frames and ONSET_RATIO
+//times the average over MEAN_SPREAD frames either side
+#define ONSET_SPREAD 3
+#define MEAN_SPREAD 16
+#define ONSET_RATIO 1.4f
+
+//The tempo is looked for between these, preferring tempos near PREFERRED_BPM
+#define MIN_BPM 60
+#define MAX_BPM 200
+#define PREFERRED_BPM 120
+
+//An onset this close to a beat counts as on the beat, in seconds
+#define BEAT_TOLERANCE 0.07
+
+//Limits that match the game: it reads at most MAX_ROWS rows
+#define MAX_ROWS 60
+#define MAX_SONGS 4096
+#define MAX_PATH 512
+#define MAX_DEPTH 16 //how deep into a music library the songs are looked for
+#define MAX_THREADS 64
+
+//Difficulties, numbered like the game's EASY_SONG, MEDIUM_SONG and HARD_SONG
+#define EASY_SONG 0
+#define MEDIUM_SONG 1
+#define HARD_SONG 2
+#define ALL_SONGS 3
+
+static const char* difficultyNames[3] = {"easy", "medium", "hard"};
+
+//The FFT and the flux are worked out four bins at a time: GCC turns arithmetic on a floatx4
+//into NEON or SSE instructions, and comparing two of them gives an intx4 mask
+typedef float floatx4 __attribute__((vector_size(16)));
+typedef int intx4 __attribute__((vector_size(16)));
+
+/*A structure for everything the FFT needs that doesn't change: the bit reversed order, the
+twiddle factors for every stage (stage half size h keeps its h factors starting at index h)
+and the Hann window. It is built once and shared by every thread
+*/
+struct fftPlan
+{
+	int bitrev[FFT_SIZE];
+	float twRe[FFT_SIZE];
+	float twIm[FFT_SIZE];
+	float window[FFT_SIZE];
+};
+
+/*A structure for the buffers one thread uses for each spectral frame
+*/
+struct fftScratch
+{
+	float re[FFT_SIZE];
+	float im[FFT_SIZE];
+	float mag[BINS];
+	float prev[BINS];
+};
+
+/*A structure for the analysis of one song. Every array has one value per spectral frame
+*/
+struct analysis
+{
+	long frames;
+	float* flux; //spectral flux over the whole spectrum
+	float* lane[LANES]; //spectral flux in each lane's bins
+	float* novelty; //how far the flux is above its local average
+	char* onset; //1 where a note starts
+	int onsets;
+	double bpm;
+	double period; //frames per beat
+	double phase; //frame of the first beat
+	double seconds;
+};
+
+/*A structure for the command line settings
+*/
+struct settings
+{
+	int difficulty; //EASY_SONG, MEDIUM_SONG, HARD_SONG or ALL_SONGS
+	double interval; //seconds per row
+	int rows;
+	int threads;
+	const char* outDir; //NULL writes the charts next to the songs
+};
+
+/*A structure for one song in the batch and what happened to it
+*/
+struct chartJob
+{
+	char path[MAX_PATH];
+	bool ok;
+	const char* error;
+	double seconds;
+	double bpm;
+	int onsets;
+};
+
+/*A structure for what the worker threads share. next is the index of the next song to take
+*/
+struct batch
+{
+	const struct fftPlan* plan;
+	const struct settings* set;
+	struct chartJob* jobs;
+	int count;
+	int next;
+};
+
+/*Reads four bins starting at p. It goes through memcpy because the buffers in struct
+fftScratch are only sure to be aligned to a float
+*/
+static inline floatx4 loadFloatx4 (const float* p)
+{
+	floatx4 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*Writes four bins starting at p, the other way round from loadFloatx4
+*/
+static inline void storeFloatx4 (float* p, const floatx4 v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+/*Works out the bit reversed order, the twiddle factors and the window
+*/
+static void buildPlan (struct fftPlan* plan)
+{
+	int bits = 0;
+
+	while ((1 << bits) < FFT_SIZE)
+		bits++;
+
+	for (int i = 0; i < FFT_SIZE; i++)
+	{
+		int reversed = 0;
+		for (int b = 0; b < bits; b++)
+			if (i & (1 << b))
+				reversed |= 1 << (bits - 1 - b);
+		plan->bitrev[i] = reversed;
+	}
+
+	plan->twRe[0] = 1;
+	plan->twIm[0] = 0;
+	for (int half = 1; half < FFT_SIZE; half *= 2)
+	{
+		for (int j = 0; j < half; j++)
+		{
+			plan->twRe[half + j] = cos(-M_PI * j / half);
+			plan->twIm[half + j] = sin(-M_PI * j / half);
+		}
+	}
+
+	for (int i = 0; i < FFT_SIZE; i++)
+		plan->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / FFT_SIZE);
+}
+
+/*An in place radix 2 FFT of FFT_SIZE complex values. The first two stages are too narrow
+for four lanes, so they are done together as one scalar radix 4 pass, and every later
+stage does four butterflies at a time
+*/
+static void fft (const struct fftPlan* plan, float* re, float* im)
+{
+	//Put the input in bit reversed order
+	for (int i = 0; i < FFT_SIZE; i++)
+	{
+		int j = plan->bitrev[i];
+		if (j > i)
+		{
+			float t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	//Stages of half size 1 (twiddle 1) and 2 (twiddles 1 and -i)
+	for (int i = 0; i < FFT_SIZE; i += 4)
+	{
+		float ar = re[i] + re[i+1], ai = im[i] + im[i+1];
+		float br = re[i] - re[i+1], bi = im[i] - im[i+1];
+		float cr = re[i+2] + re[i+3], ci = im[i+2] + im[i+3];
+		float dr = re[i+2] - re[i+3], di = im[i+2] - im[i+3];
+
+		re[i] = ar + cr; im[i] = ai + ci;
+		re[i+2] = ar - cr; im[i+2] = ai - ci;
+		re[i+1] = br + di; im[i+1] = bi - dr;
+		re[i+3] = br - di; im[i+3] = bi + dr;
+	}
+
+	//The rest of the stages, four butterflies at a time
+	for (int half = 4; half < FFT_SIZE; half *= 2)
+	{
+		const float* wr = plan->twRe + half;
+		const float* wi = plan->twIm + half;
+
+		for (int start = 0; start < FFT_SIZE; start += 2 * half)
+		{
+			float* ar = re + start;
+			float* ai = im + start;
+			float* br = ar + half;
+			float* bi = ai + half;
+
+			for (int j = 0; j < half; j += 4)
+			{
+				floatx4 xr = loadFloatx4(br + j), xi = loadFloatx4(bi + j);
+				floatx4 cr = loadFloatx4(wr + j), ci = loadFloatx4(wi + j);
+				floatx4 tr = xr * cr - xi * ci;
+				floatx4 ti = xr * ci + xi * cr;
+				floatx4 ur = loadFloatx4(ar + j), ui = loadFloatx4(ai + j);
+
+				storeFloatx4(ar + j, ur + tr);
+				storeFloatx4(ai + j, ui + ti);
+				storeFloatx4(br + j, ur - tr);
+				storeFloatx4(bi + j, ui - ti);
+			}
+		}
+	}
+}
+
+/*Returns the sum of how much each bin from "from" to "to" grew since the last frame. Bins
+that got quieter count as 0. from and to must be multiples of 4
+*/
+static float rectifiedFlux (const float* now, const float* before, const int from, const int to)
+{
+	const floatx4 zero = {0, 0, 0, 0};
+	floatx4 sum = zero;
+
+	for (int k = from; k < to; k += 4)
+	{
+		floatx4 d = loadFloatx4(now + k) - loadFloatx4(before + k);
+		sum += (floatx4) ((intx4) d & (d > zero));
+	}
+	return sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+/*Works out the spectral flux of every frame of the song, in total and for each lane
+*/
+static void spectralFlux (const struct fftPlan* plan, struct fftScratch* s, const short* pcm, struct analysis* a)
+{
+	const floatx4 zero = {0, 0, 0, 0};
+
+	memset(s->prev, 0, sizeof(s->prev));
+	for (long f = 0; f < a->frames; f++)
+	{
+		const short* in = pcm + f * FFT_HOP;
+
+		for (int i = 0; i < FFT_SIZE; i++)
+			s->re[i] = in[i];
+		for (int i = 0; i < FFT_SIZE; i += 4)
+		{
+			storeFloatx4(s->re + i, loadFloatx4(s->re + i) * loadFloatx4(plan->window + i));
+			storeFloatx4(s->im + i, zero);
+		}
+
+		fft(plan, s->re, s->im);
+
+		//Log compressed magnitudes, so quiet notes still stand out against loud ones
+		for (int k = 0; k < BINS; k += 4)
+		{
+			floatx4 r = loadFloatx4(s->re + k), m = loadFloatx4(s->im + k);
+			storeFloatx4(s->mag + k, r * r + m * m);
+		}
+		for (int k = 0; k < BINS; k++)
+			s->mag[k] = log1pf(sqrtf(s->mag[k]) * (1.0f / 32768));
+
+		a->lane[0][f] = rectifiedFlux(s->mag, s->prev, 0, LOW_BINS);
+		a->lane[1][f] = rectifiedFlux(s->mag, s->prev, LOW_BINS, MID_BINS);
+		a->lane[2][f] = rectifiedFlux(s->mag, s->prev, MID_BINS, HIGH_BINS);
+		a->flux[f] = a->lane[0][f] + a->lane[1][f] + a->lane[2][f] + rectifiedFlux(s->mag, s->prev, HIGH_BINS, BINS);
+
+		//The first frame has nothing to compare with, so it can't be an onset
+		if (f == 0)
+			a->flux[0] = a->lane[0][0] = a->lane[1][0] = a->lane[2][0] = 0;
+
+		memcpy(s->prev, s->mag, sizeof(s->prev));
+	}
+}
+
+/*Marks the onsets: peaks of the flux that stand well above its local average. The novelty
+(the flux above the local average) is kept for the tempo search
+*/
+static void pickOnsets (struct analysis* a)
+{
+	double total = 0;
+	double windowSum = 0;
+	long low = 0, high = 0; //the frames in windowSum are low to high-1
+
+	for (long f = 0; f < a->frames; f++)
+		total += a->flux[f];
+	const float minimum = 0.1 * total / (a->frames ? a->frames : 1);
+
+	a->onsets = 0;
+	for (long f = 0; f < a->frames; f++)
+	{
+		//Slide the window for the local average along
+		while (high < a->frames && high <= f + MEAN_SPREAD)
+			windowSum += a->flux[high++];
+		while (low < f - MEAN_SPREAD)
+			windowSum -= a->flux[low++];
+		const float mean = windowSum / (high - low);
+
+		a->novelty[f] = (a->flux[f] > mean) ? a->flux[f] - mean : 0;
+		a->onset[f] = false;
+
+		if (a->flux[f] < ONSET_RATIO * mean + minimum)
+			continue;
+
+		bool peak = true;
+		for (long g = f - ONSET_SPREAD; g <= f + ONSET_SPREAD && peak; g++)
+			if (g >= 0 && g < a->frames && g != f && (a->flux[g] > a->flux[f] || (a->flux[g] == a->flux[f] && g < f)))
+				peak = false;
+		if (peak)
+		{
+			a->onset[f] = true;
+			a->onsets++;
+		}
+	}
+}
+
+/*Finds the tempo from the autocorrelation of the novelty, preferring tempos near
+PREFERRED_BPM, and then the phase of the beat that lines up with the most novelty
+*/
+static void detectTempo (struct analysis* a)
+{
+	const int shortest = floor(60 * FRAMES_PER_SECOND / MAX_BPM);
+	const int longest = ceil(60 * FRAMES_PER_SECOND / MIN_BPM);
+	double score[longest + 2];
+	int best = 0;
+
+	a->bpm = 0;
+	a->period = 0;
+	a->phase = 0;
+	if (a->frames < 2 * longest)
+		return;
+
+	//The logarithm keeps loud hits from drowning out the rest (otherwise a loud snare on
+	//every other beat halves the tempo), and smoothing over 3 frames lets beats that fall
+	//between two frames still line up
+	float* strength = (float*) malloc(a->frames * sizeof(float));
+	if (!strength)
+		return;
+	for (long f = 0; f < a->frames; f++)
+		strength[f] = log1pf(a->novelty[f]);
+	float last = strength[a->frames - 1];
+	for (long f = a->frames - 2; f > 0; f--)
+	{
+		float here = strength[f];
+		strength[f] = 0.25f * strength[f - 1] + 0.5f * here + 0.25f * last;
+		last = here;
+	}
+
+	for (int lag = shortest - 1; lag <= longest + 1; lag++)
+	{
+		double sum = 0;
+		for (long f = 0; f + lag < a->frames; f++)
+			sum += strength[f] * strength[f + lag];
+
+		//Weight by how far the tempo is from the preferred one, in octaves
+		double octaves = log2(60 * FRAMES_PER_SECOND / lag / PREFERRED_BPM);
+		score[lag] = sum / (a->frames - lag) * exp(-0.5 * octaves * octaves);
+		if (lag >= shortest && lag <= longest && (best == 0 || score[lag] > score[best]))
+			best = lag;
+	}
+	free(strength);
+
+	//A parabola through the best lag and its neighbours gives a fraction of a frame
+	a->period = best;
+	double curve = score[best - 1] - 2 * score[best] + score[best + 1];
+	if (curve < 0)
+		a->period += 0.5 * (score[best - 1] - score[best + 1]) / curve;
+	a->bpm = 60 * FRAMES_PER_SECOND / a->period;
+
+	//Try every starting frame within one beat
+	double bestPhase = -1;
+	for (int start = 0; start < (int) a->period; start++)
+	{
+		double sum = 0;
+		for (double f = start; f < a->frames; f += a->period)
+			sum += a->novelty[(long) (f + 0.5) < a->frames ? (long) (f + 0.5) : a->frames - 1];
+		if (sum > bestPhase)
+		{
+			bestPhase = sum;
+			a->phase = start;
+		}
+	}
+}
+
+/*Returns true if frame f is within BEAT_TOLERANCE of a beat
+*/
+static bool onBeat (const struct analysis* a, const long f)
+{
+	if (a->period <= 0)
+		return false;
+	double offset = fmod(f - a->phase + a->period, a->period);
+	if (offset > a->period / 2)
+		offset = a->period - offset;
+	return offset <= BEAT_TOLERANCE * FRAMES_PER_SECOND;
+}
+
+/*Writes the chart for one difficulty. The game judges row r during interval r+1 (interval 0
+is the grace period), so row r covers the song from (r+1)*interval to (r+2)*interval seconds
+and its lanes are picked from the onsets in that time (onsets on the beat count double):
+easy lights at most the strongest lane and leaves the quieter half of the rows blank,
+medium lights up to two lanes and hard up to three
+*/
+static bool writeChart (const struct analysis* a, const int difficulty, const struct settings* set, const char* path)
+{
+	static const float laneRatio[3] = {1.0f, 0.5f, 0.25f};
+	double lanes[MAX_ROWS][LANES] = {{0}};
+	double strength[MAX_ROWS] = {0};
+	double laneMean[LANES] = {0};
+	double sorted[MAX_ROWS];
+	int used = 0;
+	double median = 0;
+	FILE* chartFile;
+
+	//Lanes cover different numbers of bins, so each is measured against its own average
+	for (long f = 0; f < a->frames; f++)
+		for (int l = 0; l < LANES; l++)
+			laneMean[l] += a->lane[l][f];
+	for (int l = 0; l < LANES; l++)
+		laneMean[l] = laneMean[l] / (a->frames ? a->frames : 1) + 1e-9;
+
+	for (long f = 0; f < a->frames; f++)
+	{
+		if (!a->onset[f])
+			continue;
+		int row = (int) ((f * FFT_HOP + FFT_SIZE / 2) / (RATE * set->interval)) - 1;
+		if (row < 0) //the grace period
+			continue;
+		if (row >= set->rows)
+			break;
+		double weight = onBeat(a, f) ? 2 : 1;
+		for (int l = 0; l < LANES; l++)
+			lanes[row][l] += weight * a->lane[l][f] / laneMean[l];
+		strength[row] += weight * a->novelty[f];
+	}
+
+	//The median strength of the rows that have onsets, for easy to leave the quiet ones out
+	for (int r = 0; r < set->rows; r++)
+	{
+		if (strength[r] <= 0)
+			continue;
+		int i = used++;
+		while (i > 0 && sorted[i - 1] > strength[r])
+		{
+			sorted[i] = sorted[i - 1];
+			i--;
+		}
+		sorted[i] = strength[r];
+	}
+	if (used > 0)
+		median = sorted[used / 2];
+
+	chartFile = fopen(path, "w");
+	if (!chartFile)
+		return false;
+
+	for (int r = 0; r < set->rows; r++)
+	{
+		int status[LANES] = {0};
+		double strongest = 0;
+
+		for (int l = 0; l < LANES; l++)
+			if (lanes[r][l] > strongest)
+				strongest = lanes[r][l];
+
+		if (strongest > 0 && !(difficulty == EASY_SONG && strength[r] < median))
+		{
+			//Light the lanes close enough to the strongest, loudest first, up to the limit
+			for (int lit = 0; lit <= difficulty; lit++)
+			{
+				int pick = -1;
+				for (int l = 0; l < LANES; l++)
+					if (!status[l] && lanes[r][l] >= laneRatio[difficulty] * strongest && (pick < 0 || lanes[r][l] > lanes[r][pick]))
+						pick = l;
+				if (pick < 0)
+					break;
+				status[pick] = 1;
+			}
+		}
+		fprintf(chartFile, "%d %d %d\n", status[0], status[1], status[2]);
+	}
+
+	return fclose(chartFile) == 0;
+}
+
+/*Decodes the mp3 at path with the decoder mh into a mono buffer that it allocates. Returns
+the number of samples, or -1 if the file couldn't be decoded
+*/
+static long decodeMono (mpg123_handle* mh, const char* path, short** pcm)
+{
+	size_t done;
+	size_t capacity;
+	size_t size = 0;
+	off_t length;
+	int err = MPG123_ERR;
+
+	*pcm = NULL;
+	if (mpg123_open(mh, path) != MPG123_OK)
+		return -1;
+
+	//The buffer is sized from the length, and without a scan mpg123 only guesses it from
+	//the bitrate of the first frames
+	mpg123_scan(mh);
+	length = mpg123_length(mh);
+	capacity = (length > 0 ? length + 1152 : 0) * sizeof(short);
+	if (capacity)
+		*pcm = (short*) malloc(capacity);
+
+	while (*pcm && size < capacity)
+	{
+		err = mpg123_read(mh, (unsigned char*) *pcm + size, capacity - size, &done);
+		size += done;
+		if (err != MPG123_OK && err != MPG123_NEW_FORMAT)
+			break;
+	}
+	mpg123_close(mh);
+
+	if (err != MPG123_DONE)
+	{
+		free(*pcm);
+		*pcm = NULL;
+		return -1;
+	}
+	return size / sizeof(short);
+}
+
+/*Works out the path of the chart for a song at one difficulty: the song's name without
+.mp3, then .easy.log, .medium.log or .hard.log, in outDir if there is one
+*/
+static void chartPath (char* path, const size_t size, const char* songPath, const char* outDir, const int difficulty)
+{
+	const char* name = strrchr(songPath, '/');
+	int length;
+
+	if (outDir)
+	{
+		name = name ? name + 1 : songPath;
+		length = strlen(name);
+		if (length > 4 && strcasecmp(name + length - 4, ".mp3") == 0)
+			length -= 4;
+		snprintf(path, size, "%s/%.*s.%s.log", outDir, length, name, difficultyNames[difficulty]);
+	}
+	else
+	{
+		length = strlen(songPath);
+		if (length > 4 && strcasecmp(songPath + length - 4, ".mp3") == 0)
+			length -= 4;
+		snprintf(path, size, "%.*s.%s.log", length, songPath, difficultyNames[difficulty]);
+	}
+}
+
+/*Works out the flux, onsets and tempo of samples of mono audio into a, allocating its
+arrays. Returns false if they couldn't be allocated
+*/
+static bool analyse (const struct fftPlan* plan, struct fftScratch* scratch, const short* pcm, const long samples, struct analysis* a)
+{
+	a->frames = (samples >= FFT_SIZE) ? (samples - FFT_SIZE) / FFT_HOP + 1 : 0;
+	a->seconds = (double) samples / RATE;
+	a->flux = (float*) malloc(a->frames * (LANES + 2) * sizeof(float) + 1);
+	a->onset = (char*) malloc(a->frames + 1);
+	if (!a->flux || !a->onset)
+	{
+		free(a->flux);
+		free(a->onset);
+		a->flux = NULL;
+		a->onset = NULL;
+		return false;
+	}
+	for (int l = 0; l < LANES; l++)
+		a->lane[l] = a->flux + (l + 1) * a->frames;
+	a->novelty = a->flux + (LANES + 1) * a->frames;
+
+	spectralFlux(plan, scratch, pcm, a);
+	pickOnsets(a);
+	detectTempo(a);
+	return true;
+}
+
+/*Decodes, analyses and writes the charts for one song
+*/
+static void chartSong (const struct fftPlan* plan, struct fftScratch* scratch, mpg123_handle* mh, const struct settings* set, struct chartJob* job)
+{
+	struct analysis a = {0};
+	short* pcm;
+	long samples = decodeMono(mh, job->path, &pcm);
+	char path[MAX_PATH + 20];
+
+	job->ok = false;
+	if (samples < 0)
+	{
+		job->error = "decode_failed";
+		return;
+	}
+
+	if (!analyse(plan, scratch, pcm, samples, &a))
+	{
+		job->error = "out_of_memory";
+		free(pcm);
+		return;
+	}
+
+	job->ok = true;
+	job->error = "";
+	for (int d = 0; d < 3; d++)
+	{
+		if (set->difficulty != ALL_SONGS && set->difficulty != d)
+			continue;
+		chartPath(path, sizeof(path), job->path, set->outDir, d);
+		if (!writeChart(&a, d, set, path))
+		{
+			job->ok = false;
+			job->error = "write_failed";
+		}
+	}
+
+	job->seconds = a.seconds;
+	job->bpm = a.bpm;
+	job->onsets = a.onsets;
+	free(a.flux);
+	free(a.onset);
+	free(pcm);
+}
+
+/*A worker thread: takes the next song from the batch until there are none left
+*/
+static void* chartWorker (void* arg)
+{
+	struct batch* b = (struct batch*) arg;
+	struct fftScratch* scratch = (struct fftScratch*) malloc(sizeof(struct fftScratch));
+	int err;
+	mpg123_handle* mh = mpg123_new(NULL, &err);
+	int i;
+
+	if (!scratch || !mh)
+	{
+		free(scratch);
+		return NULL;
+	}
+
+	/* only allow mono at RATE, mpg123 resamples and mixes down to it */
+	mpg123_format_none(mh);
+	mpg123_format(mh, RATE, MPG123_MONO, MPG123_ENC_SIGNED_16);
+
+	while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count)
+		chartSong(b->plan, scratch, mh, b->set, &b->jobs[i]);
+
+	mpg123_delete(mh);
+	free(scratch);
+	return NULL;
+}
+
+/*Adds path to the batch: a directory adds every .mp3 file in it and in the directories
+below it (up to MAX_DEPTH deep, so an Artist/Album/track.mp3 library is found too). Returns
+false if the batch is full
+*/
+static bool addSongs (struct chartJob* jobs, int* count, const char* path, const int depth)
+{
+	struct stat st;
+	DIR* dir;
+	struct dirent* entry;
+	char child[MAX_PATH];
+	bool room = true;
+
+	if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+	{
+		if (*count >= MAX_SONGS)
+			return false;
+		snprintf(jobs[(*count)++].path, MAX_PATH, "%s", path);
+		return true;
+	}
+
+	dir = opendir(path);
+	if (!dir)
+		return true;
+	while (room && (entry = readdir(dir)) != NULL)
+	{
+		int length = strlen(entry->d_name);
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int) sizeof(child))
+			continue;
+
+		if (stat(child, &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			if (depth < MAX_DEPTH)
+				room = addSongs(jobs, count, child, depth + 1);
+		}
+		else if (length > 4 && strcasecmp(entry->d_name + length - 4, ".mp3") == 0)
+		{
+			room = *count < MAX_SONGS;
+			if (room)
+				snprintf(jobs[(*count)++].path, MAX_PATH, "%s", child);
+		}
+	}
+	closedir(dir);
+	return room;
+}
+
+/*Returns a pseudo random number from -1 to 1. The self test uses its own generator so
+every run checks the same signals
+*/
+static double testNoise (unsigned* state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 8) / 8388608.0 - 1;
+}
+
+/*Prints one line of the self test and returns 1 if it failed
+*/
+static int testResult (const char* check, const double value, const double expected, const double tolerance)
+{
+	bool ok = fabs(value - expected) <= tolerance;
+
+	printf("%s,%g,%g,%g,%s\n", check, value, expected, tolerance, ok ? "ok" : "failed");
+	return ok ? 0 : 1;
+}
+
+/*Checks the analysis on signals with a known answer: the FFT against a plain DFT worked out
+in doubles, and the onsets and tempo of click tracks (a 5 ms burst of noise on every beat).
+Returns the number of checks that failed
+*/
+static int selfTest (const struct fftPlan* plan)
+{
+	static const double tempos[3] = {90, 120, 150};
+	struct fftScratch* scratch = (struct fftScratch*) malloc(sizeof(struct fftScratch));
+	const long samples = 12 * RATE;
+	short* pcm = (short*) malloc(samples * sizeof(short));
+	static double inRe[FFT_SIZE], inIm[FFT_SIZE];
+	unsigned seed = 1;
+	double largest = 0, error = 0;
+	char check[40];
+	int failed = 0;
+
+	if (!scratch || !pcm)
+	{
+		free(scratch);
+		free(pcm);
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	printf("check,value,expected,tolerance,status\n");
+
+	//The FFT against the DFT, relative to the largest bin
+	for (int i = 0; i < FFT_SIZE; i++)
+	{
+		scratch->re[i] = inRe[i] = testNoise(&seed);
+		scratch->im[i] = inIm[i] = testNoise(&seed);
+	}
+	fft(plan, scratch->re, scratch->im);
+	for (int k = 0; k < FFT_SIZE; k++)
+	{
+		double re = 0, im = 0;
+		for (int n = 0; n < FFT_SIZE; n++)
+		{
+			double angle = -2 * M_PI * ((long) k * n % FFT_SIZE) / FFT_SIZE;
+			re += inRe[n] * cos(angle) - inIm[n] * sin(angle);
+			im += inRe[n] * sin(angle) + inIm[n] * cos(angle);
+		}
+		if (hypot(re, im) > largest)
+			largest = hypot(re, im);
+		if (hypot(scratch->re[k] - re, scratch->im[k] - im) > error)
+			error = hypot(scratch->re[k] - re, scratch->im[k] - im);
+	}
+	failed += testResult("fft_error", error / largest, 0, 1e-5);
+
+	//Click tracks, with the clicks starting a quarter of a second in and stopping a second
+	//before the end so every one is inside a whole frame
+	for (int t = 0; t < 3; t++)
+	{
+		struct analysis a = {0};
+		const long beat = 60.0 / tempos[t] * RATE;
+		int clicks = 0;
+
+		memset(pcm, 0, samples * sizeof(short));
+		for (long start = RATE / 4; start < samples - RATE; start += beat)
+		{
+			for (int i = 0; i < RATE / 200; i++)
+				pcm[start + i] = 16000 * testNoise(&seed) * (1 - i / (RATE / 200.0));
+			clicks++;
+		}
+
+		if (!analyse(plan, scratch, pcm, samples, &a))
+		{
+			fprintf(stderr, "Out of memory\n");
+			failed++;
+			continue;
+		}
+		snprintf(check, sizeof(check), "clicks%.0f_onsets", tempos[t]);
+		failed += testResult(check, a.onsets, clicks, 0);
+		snprintf(check, sizeof(check), "clicks%.0f_bpm", tempos[t]);
+		failed += testResult(check, a.bpm, tempos[t], 0.02 * tempos[t]);
+		free(a.flux);
+		free(a.onset);
+	}
+
+	free(scratch);
+	free(pcm);
+	return failed;
+}
+
+int main (const int argc, const char* const argv[])
+{
+	struct settings set = {.difficulty = ALL_SONGS, .interval = 2, .rows = 30, .threads = 0, .outDir = NULL};
+	static struct chartJob jobs[MAX_SONGS];
+	static struct fftPlan plan;
+	struct batch b = {.plan = &plan, .set = &set, .jobs = jobs, .count = 0, .next = 0};
+	struct timespec start, end;
+	int failed = 0;
+	bool selfTesting = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--self-test") == 0)
+			selfTesting = true;
+		else if (strcmp(argv[i], "--difficulty") == 0 && i + 1 < argc)
+		{
+			i++;
+			set.difficulty = -1;
+			for (int d = 0; d < 3; d++)
+				if (strcmp(argv[i], difficultyNames[d]) == 0)
+					set.difficulty = d;
+			if (strcmp(argv[i], "all") == 0)
+				set.difficulty = ALL_SONGS;
+			if (set.difficulty < 0)
+			{
+				fprintf(stderr, "Unknown difficulty %s\n", argv[i]);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+			set.interval = atof(argv[++i]);
+		else if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc)
+			set.rows = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			set.threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+			set.outDir = argv[++i];
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "Usage: %s [--difficulty easy|medium|hard|all] [--interval SECONDS] [--rows N] "
+				"[--threads N] [--out DIRECTORY] FILE.mp3|DIRECTORY...\n       %s --self-test\n", argv[0], argv[0]);
+			return 2;
+		}
+		else if (!addSongs(jobs, &b.count, argv[i], 0))
+		{
+			fprintf(stderr, "Only the first %d songs will be charted\n", MAX_SONGS);
+			break;
+		}
+	}
+
+	if (selfTesting)
+	{
+		buildPlan(&plan);
+		return selfTest(&plan) ? 1 : 0;
+	}
+
+	if (b.count == 0 || set.interval <= 0 || set.rows < 1)
+	{
+		fprintf(stderr, "Nothing to chart (give some mp3 files, a positive --interval and --rows)\n");
+		return 2;
+	}
+	if (set.rows > MAX_ROWS)
+		set.rows = MAX_ROWS;
+
+	//One thread per core by default, but never more than MAX_THREADS or more threads than songs
+	if (set.threads < 1)
+		set.threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (set.threads < 1)
+		set.threads = 1;
+	if (set.threads > MAX_THREADS)
+		set.threads = MAX_THREADS;
+	if (set.threads > b.count)
+		set.threads = b.count;
+
+	buildPlan(&plan);
+	mpg123_init();
+
+	pthread_t threads[MAX_THREADS];
+	bool started[MAX_THREADS];
+	int running = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int t = 0; t < set.threads; t++)
+	{
+		started[t] = pthread_create(&threads[t], NULL, chartWorker, &b) == 0;
+		running += started[t];
+	}
+	//If a thread couldn't be made this one takes its place, so every song is still charted
+	if (running < set.threads)
+		chartWorker(&b);
+	for (int t = 0; t < set.threads; t++)
+		if (started[t])
+			pthread_join(threads[t], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("song,seconds,bpm,onsets,status\n");
+	for (int i = 0; i < b.count; i++)
+	{
+		if (jobs[i].ok)
+			printf("%s,%.1f,%.1f,%d,ok\n", jobs[i].path, jobs[i].seconds, jobs[i].bpm, jobs[i].onsets);
+		else
+		{
+			printf("%s,,,,%s\n", jobs[i].path, jobs[i].error ? jobs[i].error : "not_started");
+			failed++;
+		}
+	}
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "%d songs charted (%d failed) in %.2f s on %d threads: %.1f songs per minute\n",
+		b.count - failed, failed, elapsed, set.threads, b.count / elapsed * 60);
+
+	mpg123_exit();
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * A sample reader for the live game state that GuitarZero publishes in shared memory. It
+ * maps the segment read-only and prints a line every time the state changes, which is all a
+ * spectator screen or a monitoring tool needs to do. Reading never blocks the game.
+ *
+ * Build:  gcc -O2 -o GuitarZeroMonitor GuitarZeroMonitor.c -lrt
+ * Usage:  ./GuitarZeroMonitor [--once] [--name NAME]
+ *
+ * --once prints the current state and exits, --name reads a segment other than the default
+ * /GuitarZeroState.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "GuitarZeroState.h"
+
+//How often the segment is checked for a new state, in microseconds
+#define POLL_INTERVAL 50000
+
+/*Returns a short name for a phase
+*/
+static const char* phaseName(const int phase)
+{
+	switch (phase)
+	{
+		case PHASE_STARTING: return "starting";
+		case PHASE_WAITING: return "waiting";
+		case PHASE_PLAYING: return "playing";
+		case PHASE_FINISHED: return "finished";
+		default: return "unknown";
+	}
+}
+
+/*Returns a short name for a judgement
+*/
+static const char* judgementName(const int judgement)
+{
+	switch (judgement)
+	{
+		case JUDGEMENT_CORRECT: return "correct";
+		case JUDGEMENT_INCORRECT: return "incorrect";
+		default: return "-";
+	}
+}
+
+/*Prints one snapshot. Rows are shown as three characters, # for an LED that is on
+*/
+static void printState(const struct gameStatePayload* s, const int retries)
+{
+	printf("%-8s interval %2d/%-2d  row %c%c%c  next %c%c%c  score %2d  last %-9s  strums %3d  "
+		"interval %d ms  late %d ms  poll gap %d us  difficulty %d  speed %d%%  (update %llu, %d retries)\n",
+		phaseName(s->phase), s->intervalCounter, s->maxIntervals,
+		s->currentRow[0] ? '#' : '.', s->currentRow[1] ? '#' : '.', s->currentRow[2] ? '#' : '.',
+		s->nextRow[0] ? '#' : '.', s->nextRow[1] ? '#' : '.', s->nextRow[2] ? '#' : '.',
+		s->correct, judgementName(s->lastJudgement), s->strums,
+		s->intervalMs, s->lastIntervalLateMs, s->maxPollGapUs, s->difficulty, s->practiceSpeed,
+		(unsigned long long) s->updates, retries);
+	fflush(stdout);
+}
+
+int main (const int argc, const char* const argv[])
+{
+	const char* name = GAME_STATE_NAME;
+	int once = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--once") == 0)
+			once = 1;
+		else if (strcmp(argv[i], "--name") == 0 && i + 1 < argc)
+			name = argv[++i];
+		else
+		{
+			fprintf(stderr, "Usage: %s [--once] [--name NAME]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+	{
+		perror("Couldn't open the game state (is GuitarZero running?)");
+		return 1;
+	}
+
+	const struct gameState* state = mmap(NULL, sizeof(struct gameState), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (state == MAP_FAILED)
+	{
+		perror("Couldn't map the game state");
+		return 1;
+	}
+
+	if (state->version != GAME_STATE_VERSION)
+	{
+		fprintf(stderr, "The game state is version %u, this monitor reads version %d\n", state->version, GAME_STATE_VERSION);
+		return 1;
+	}
+
+	struct gameStatePayload snapshot;
+	uint64_t lastUpdate = 0;
+	int retries = gameStateRead(state, &snapshot);
+	printState(&snapshot, retries);
+	lastUpdate = snapshot.updates;
+
+	while (!once)
+	{
+		usleep(POLL_INTERVAL);
+		retries = gameStateRead(state, &snapshot);
+		if (snapshot.updates != lastUpdate)
+		{
+			printState(&snapshot, retries);
+			lastUpdate = snapshot.updates;
+		}
+	}
+
+	munmap((void*) state, sizeof(struct gameState));
+	return 0;
+}
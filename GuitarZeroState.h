@@ -0,0 +1,102 @@
+/*
+ * The live game state that GuitarZero publishes in POSIX shared memory, for spectator
+ * screens and monitoring tools. The game is the only writer. Any number of readers can map
+ * the segment read-only and take consistent snapshots with gameStateRead(), which never
+ * makes a system call and never blocks the game.
+ *
+ * Consistency comes from a sequence lock: the writer makes the sequence number odd while it
+ * changes the payload and even again when it is done. A reader copies the payload and keeps
+ * the copy only if the sequence number was the same even value before and after.
+ */
+#ifndef GUITARZEROSTATE_H
+#define GUITARZEROSTATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+//Name of the shared memory segment (it shows up as /dev/shm/GuitarZeroState)
+#define GAME_STATE_NAME "/GuitarZeroState"
+
+//Bumped whenever struct gameStatePayload changes, so old readers can tell
+#define GAME_STATE_VERSION 1
+
+//Values of gameStatePayload.phase
+#define PHASE_STARTING 0
+#define PHASE_WAITING 1 //waiting for a button to start the song
+#define PHASE_PLAYING 2
+#define PHASE_FINISHED 3
+
+//Values of gameStatePayload.lastJudgement
+#define JUDGEMENT_NONE 0
+#define JUDGEMENT_CORRECT 1
+#define JUDGEMENT_INCORRECT 2
+
+/*A structure for everything a reader can see. Rows are the LED statuses (1 is on) of the row
+being judged and the row after it
+*/
+struct gameStatePayload
+{
+	int32_t phase;
+	int32_t difficulty; //EASY_SONG, MEDIUM_SONG or HARD_SONG
+	int32_t practiceSpeed; //percent, 100 outside practice mode
+	int32_t intervalCounter;
+	int32_t maxIntervals;
+	uint8_t currentRow[3];
+	uint8_t nextRow[3];
+	uint8_t padding[2];
+	int32_t correct; //the score so far
+	int32_t lastJudgement;
+	int32_t strums; //laser breaks so far this song
+	int32_t intervalMs; //how long each interval lasts
+	int32_t lastIntervalLateMs; //how far past its deadline the last interval was closed
+	int32_t maxPollGapUs; //longest gap between two polls of the laser this song
+	int64_t songStartMs; //monotonic clock when the song started
+	uint64_t updates; //number of times the state has been published
+};
+
+/*A structure for the whole shared memory segment
+*/
+struct gameState
+{
+	uint32_t version;
+	_Atomic uint32_t sequence; //odd while the writer is changing the payload
+	struct gameStatePayload payload;
+};
+
+/*Publishes a new payload. Only one thread may call this for a segment
+*/
+static inline void gameStateWrite (struct gameState* state, const struct gameStatePayload* payload)
+{
+	uint32_t sequence = atomic_load_explicit(&state->sequence, memory_order_relaxed);
+
+	atomic_store_explicit(&state->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&state->payload, payload, sizeof(*payload));
+	atomic_store_explicit(&state->sequence, sequence + 2, memory_order_release);
+}
+
+/*Copies a consistent snapshot of the payload into out. Returns the number of times it had
+to try again because the writer was in the middle of an update
+*/
+static inline int gameStateRead (const struct gameState* state, struct gameStatePayload* out)
+{
+	int retries = 0;
+	uint32_t before, after;
+
+	while (1)
+	{
+		before = atomic_load_explicit(&((struct gameState*) state)->sequence, memory_order_acquire);
+		if (!(before & 1))
+		{
+			memcpy(out, (const void*) &state->payload, sizeof(*out));
+			atomic_thread_fence(memory_order_acquire);
+			after = atomic_load_explicit(&((struct gameState*) state)->sequence, memory_order_relaxed);
+			if (before == after)
+				return retries;
+		}
+		retries++;
+	}
+}
+
+#endif
@@ -0,0 +1,1086 @@
+/*
+ * Offline log analyzer for Guitar Zero. It reads the game log and the score log, including
+ * all of their rotated segments (plain or gzipped), and prints how many songs were played in
+ * each hour of the day, how accurate the players were on each song, and which rows of each
+ * song are missed the most. The files are memory mapped, cut into chunks at line boundaries
+ * and parsed on all cores, so a long history of logs is read in seconds.
+ *
+ * Build:  gcc -O2 -o GuitarZeroStats GuitarZeroStats.c -lz -lpthread
+ * Usage:  ./GuitarZeroStats [--threads N] LOG...
+ *
+ * Each LOG is the name the game writes to (e.g. /home/pi/GuitarZero.log and
+ * /home/pi/score.log). Its closed segments LOG.0, LOG.1.gz, ... are found next to it and read
+ * oldest first, with the active file last. Half written files are fine: a last line without
+ * its newline, a truncated .gz, or a .gz.tmp the compressor never finished are skipped and
+ * counted. The tables go to stdout, and how fast the logs were read to stderr.
+ */
+
+#define _GNU_SOURCE		//for mremap()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>		//for LONG_MAX
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>		//for sysconf()
+#include <dirent.h>		//for finding the rotated segments
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define true 1
+#define false 0
+typedef int bool;
+
+//The game reads at most MAX_ROWS rows of a chart
+#define MAX_ROWS 60
+
+//Songs, numbered like the game's EASY_SONG, MEDIUM_SONG and HARD_SONG. Songs played by a
+//game from before the song was logged count as unknown
+#define EASY_SONG 0
+#define MEDIUM_SONG 1
+#define HARD_SONG 2
+#define UNKNOWN_SONG 3
+#define SONG_KINDS 4
+
+static const char* songNames[SONG_KINDS] = {"easy", "medium", "hard", "unknown"};
+
+//Limits on the number of files read, their path length and the number of threads
+#define MAX_INPUTS 4096
+#define MAX_PATH 512
+#define MAX_THREADS 64
+
+//The files are parsed in chunks of about this size, so a big file still keeps every core busy
+#define CHUNK_BYTES (4 << 20)
+
+//A log line starts with "MM-DD-YYYY  HH:MM:SS. : ", the time written by getTime()
+#define STAMP_LENGTH 21
+#define PREFIX_LENGTH (STAMP_LENGTH + 3)
+
+//How many of the most missed rows are listed
+#define HOTSPOTS 5
+
+//What a log line says, as far as the tables are concerned
+enum lineKind
+{
+	LINE_MALFORMED,		//not a log line at all
+	LINE_OTHER,		//a log line the tables don't use
+	LINE_START,		//"Game Comencing": a song starts
+	LINE_SONG,		//"Playing the X song from interval N"
+	LINE_RESUMED,		//"Resumed song E at interval I with a score of S, ..." before a resumed song starts
+	LINE_CORRECT,		//"Correct Response"
+	LINE_INCORRECT,		//"Incorrect Response"
+	LINE_END,		//"Song completed and score updated"
+	LINE_SCORE		//a two digit line of the score log
+};
+
+/*One parsed log line. Nothing is copied: the parser only fills in these numbers
+*/
+struct lineEvent
+{
+	enum lineKind kind;
+	int hour; //hour of the day the line was written
+	long long stamp; //the time as YYYYMMDDhhmmss, so times compare as numbers
+	int song; //LINE_SONG: which song
+	int value; //LINE_SONG: the first interval, LINE_RESUMED: the score so far, LINE_SCORE: the score
+};
+
+/*The totals for one song
+*/
+struct songTally
+{
+	long long sessions; //times the song was started (a resumed song is started twice)
+	long long completed; //times it was played to the end
+	long long interrupted; //times the game stopped during it (crash, reset or restart)
+	long long resumed; //times it was resumed from a checkpoint
+	long long judged; //responses judged against a row (the first interval is a grace period)
+	long long correct; //of which were correct
+	long long scoreSum; //sum of the final scores of the completed songs
+	int best; //best final score
+};
+
+/*The song being played while the lines are read. A song started in one chunk can end in a
+later one, so this is carried from chunk to chunk
+*/
+struct session
+{
+	bool open; //a song has started and hasn't ended
+	int song;
+	int from; //interval the song started (or resumed) from
+	int responses; //responses logged since then
+	int correct; //correct responses since then
+	int baseScore; //score it was resumed with
+	bool resumed;
+	bool pendingResume; //a "Resumed song" line was read, so the next song starts with pendingScore
+	int pendingScore;
+};
+
+/*The first song a chunk closed, kept so it can be fixed up if it turns out to have been
+resumed by a line at the end of the chunk before
+*/
+struct closedSession
+{
+	int song;
+	int correct;
+	bool completed;
+};
+
+/*Everything counted from some lines. Each chunk fills its own, and they are added up in
+order at the end
+*/
+struct tally
+{
+	long long lines; //non blank lines
+	long long malformed; //lines that aren't log lines
+	long long partial; //last lines of a file that were cut off
+	long long orphans; //responses with no song started before them (the segment was deleted)
+	long long first; //earliest and latest time seen, 0 if none
+	long long last;
+
+	long long hourSessions[24]; //songs started in each hour of the day
+	long long hourCompleted[24];
+	long long hourJudged[24];
+	long long hourCorrect[24];
+	long long hourScores[24]; //non zero scores written to the score log
+	long long hourScoreSum[24];
+	long long zeroScores; //00 lines in the score log (one is written at every startup)
+
+	struct songTally songs[SONG_KINDS];
+	long long rowAttempts[SONG_KINDS][MAX_ROWS];
+	long long rowMisses[SONG_KINDS][MAX_ROWS];
+
+	long long closedSessions;
+	struct closedSession firstClosed;
+};
+
+/*One file to read: a closed segment or an active log
+*/
+struct input
+{
+	char path[MAX_PATH];
+	long seq; //segment number, LONG_MAX for the active log
+	bool gz;
+	const char* data; //the text, mapped from the file or decompressed into anonymous memory
+	size_t size;
+	size_t mapped; //bytes to munmap
+	size_t diskBytes; //size of the file itself
+	bool damaged; //the .gz was cut off or corrupt, so only what decompressed is read
+	bool failed; //the file couldn't be read at all
+};
+
+/*A piece of one file, starting at a line and ending after a newline (or at the end of the
+file). The worker skips the lines before the first song start (or resume) and leaves them
+to be read in order with the song carried from the chunk before
+*/
+struct chunk
+{
+	const char* start;
+	const char* end;
+	const char* body; //the first "Game Comencing" or "Resumed song" line, or end if there is none
+	bool bodyResumes; //body is a "Resumed song" line
+	struct tally t;
+	struct session tail; //the song still going at the end of the chunk
+};
+
+/*The work shared by the threads: files to map, then chunks to parse
+*/
+struct batch
+{
+	struct input* inputs;
+	int inputCount;
+	int nextInput;
+	struct chunk* chunks;
+	int chunkCount;
+	int nextChunk;
+};
+
+/*Reads count digits at p into *value. Returns false if any of them isn't a digit
+*/
+static inline bool readDigits (const char* p, int count, int* value)
+{
+	int v = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (p[i] < '0' || p[i] > '9')
+			return false;
+		v = v * 10 + (p[i] - '0');
+	}
+	*value = v;
+	return true;
+}
+
+/*Checks that the text at p (before end) starts with text. Returns the position after it, or NULL
+*/
+static inline const char* expect (const char* p, const char* end, const char* text, size_t length)
+{
+	if (!p || end - p < (long) length || memcmp(p, text, length) != 0)
+		return NULL;
+	return p + length;
+}
+
+#define EXPECT(p, end, text) expect(p, end, text, sizeof(text) - 1)
+
+/*Reads a number at p (before end) into *value. Returns the position after it, or NULL
+*/
+static inline const char* number (const char* p, const char* end, int* value)
+{
+	const char* start = p;
+	long v = 0;
+
+	if (!p)
+		return NULL;
+	while (p < end && *p >= '0' && *p <= '9' && p - start < 9)
+		v = v * 10 + (*p++ - '0');
+	if (p == start)
+		return NULL;
+	*value = v;
+	return p;
+}
+
+/*True if the message from p to end is exactly text
+*/
+#define IS(p, end, text) ((end) - (p) == sizeof(text) - 1 && memcmp(p, text, sizeof(text) - 1) == 0)
+
+/*Parses the log line from line to end (without its newline) into e. It doesn't allocate or
+copy anything, and only looks at as much of the message as it needs
+*/
+static void parseLine (const char* line, const char* end, struct lineEvent* e)
+{
+	int month, day, year, hour, minute, second;
+	const char* message;
+	const char* p;
+
+	e->kind = LINE_MALFORMED;
+	if (end - line < PREFIX_LENGTH + 3)
+		return;
+
+	//MM-DD-YYYY  HH:MM:SS. : at fixed positions
+	if (line[2] != '-' || line[5] != '-' || line[10] != ' ' || line[11] != ' ' ||
+		line[14] != ':' || line[17] != ':' || line[20] != '.' ||
+		line[21] != ' ' || line[22] != ':' || line[23] != ' ')
+		return;
+	if (!readDigits(line, 2, &month) || !readDigits(line + 3, 2, &day) || !readDigits(line + 6, 4, &year) ||
+		!readDigits(line + 12, 2, &hour) || !readDigits(line + 15, 2, &minute) || !readDigits(line + 18, 2, &second) ||
+		hour > 23)
+		return;
+
+	//Skip the program name to the second " : "
+	message = NULL;
+	for (p = line + PREFIX_LENGTH; p + 2 < end; p++)
+	{
+		p = memchr(p, ':', end - p - 2);
+		if (!p)
+			break;
+		if (p[-1] == ' ' && p[1] == ' ')
+		{
+			message = p + 2;
+			break;
+		}
+	}
+	if (!message)
+		return;
+
+	e->hour = hour;
+	e->stamp = (((year * 100LL + month) * 100 + day) * 100 + hour) * 10000 + minute * 100 + second;
+	e->kind = LINE_OTHER;
+
+	//The score log only holds two digit scores
+	if (end - message == 2 && readDigits(message, 2, &e->value))
+	{
+		e->kind = LINE_SCORE;
+		return;
+	}
+
+	switch (message[0])
+	{
+		case 'G':
+			if (IS(message, end, "Game Comencing"))
+				e->kind = LINE_START;
+			break;
+		case 'C':
+			if (IS(message, end, "Correct Response"))
+				e->kind = LINE_CORRECT;
+			break;
+		case 'I':
+			if (IS(message, end, "Incorrect Response"))
+				e->kind = LINE_INCORRECT;
+			break;
+		case 'S':
+			if (IS(message, end, "Song completed and score updated"))
+				e->kind = LINE_END;
+			break;
+		case 'P':
+			p = EXPECT(message, end, "Playing the ");
+			if (!p)
+				break;
+			for (e->song = 0; e->song < UNKNOWN_SONG; e->song++)
+			{
+				const char* q = expect(p, end, songNames[e->song], strlen(songNames[e->song]));
+				q = EXPECT(q, end, " song from interval ");
+				if (number(q, end, &e->value))
+				{
+					e->kind = LINE_SONG;
+					break;
+				}
+			}
+			break;
+		case 'R':
+			p = EXPECT(message, end, "Resumed song ");
+			p = number(p, end, &e->value);
+			p = EXPECT(p, end, " at interval ");
+			p = number(p, end, &e->value);
+			p = EXPECT(p, end, " with a score of ");
+			if (number(p, end, &e->value))
+				e->kind = LINE_RESUMED;
+			break;
+	}
+}
+
+/*Ends the song in s. It was completed if the game logged its end, otherwise the game
+stopped during it (interrupted) or the logs end during it
+*/
+static void sessionClose (struct tally* t, struct session* s, bool completed, bool interrupted)
+{
+	struct songTally* song = &t->songs[s->song];
+
+	if (!s->open)
+		return;
+	s->open = false;
+
+	song->sessions++;
+	if (s->resumed)
+		song->resumed++;
+	if (interrupted)
+		song->interrupted++;
+	if (completed)
+	{
+		int score = s->baseScore + s->correct;
+		song->completed++;
+		song->scoreSum += score;
+		if (score > song->best)
+			song->best = score;
+	}
+
+	if (t->closedSessions++ == 0)
+		t->firstClosed = (struct closedSession) {.song = s->song, .correct = s->correct, .completed = completed};
+}
+
+/*Counts one line into t, with s the song being played
+*/
+static void countLine (struct tally* t, struct session* s, const struct lineEvent* e)
+{
+	int k;
+
+	if (e->kind == LINE_MALFORMED)
+	{
+		t->malformed++;
+		return;
+	}
+	if (t->first == 0 || e->stamp < t->first)
+		t->first = e->stamp;
+	if (e->stamp > t->last)
+		t->last = e->stamp;
+
+	switch (e->kind)
+	{
+		case LINE_START:
+			//A song still open means the game stopped during it
+			sessionClose(t, s, false, true);
+			*s = (struct session) {.open = true, .song = UNKNOWN_SONG, .resumed = s->pendingResume,
+				.baseScore = s->pendingResume ? s->pendingScore : 0};
+			t->hourSessions[e->hour]++;
+			break;
+		case LINE_SONG:
+			//Only the line logged right after the start says where the song starts
+			if (s->open && s->responses == 0)
+			{
+				s->song = e->song;
+				s->from = e->value;
+			}
+			break;
+		case LINE_RESUMED:
+			s->pendingResume = true;
+			s->pendingScore = e->value;
+			break;
+		case LINE_CORRECT:
+		case LINE_INCORRECT:
+			if (!s->open)
+			{
+				t->orphans++;
+				break;
+			}
+			//The response at interval k judges row k-1, the one at interval 0 is the grace period
+			k = s->from + s->responses++;
+			if (k < 1)
+				break;
+			t->songs[s->song].judged++;
+			t->hourJudged[e->hour]++;
+			if (k <= MAX_ROWS)
+				t->rowAttempts[s->song][k - 1]++;
+			if (e->kind == LINE_CORRECT)
+			{
+				s->correct++;
+				t->songs[s->song].correct++;
+				t->hourCorrect[e->hour]++;
+			}
+			else if (k <= MAX_ROWS)
+				t->rowMisses[s->song][k - 1]++;
+			break;
+		case LINE_END:
+			if (s->open)
+				t->hourCompleted[e->hour]++;
+			sessionClose(t, s, true, false);
+			break;
+		case LINE_SCORE:
+			if (e->value == 0)
+				t->zeroScores++;
+			else
+			{
+				t->hourScores[e->hour]++;
+				t->hourScoreSum[e->hour] += e->value;
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/*Counts the lines from p to end into t. A last line without a newline is the end of a file
+that was still being written (or a cut off .gz), so it is counted as partial and skipped
+*/
+static void countLines (struct tally* t, struct session* s, const char* p, const char* end)
+{
+	struct lineEvent e;
+
+	while (p < end)
+	{
+		const char* newline = memchr(p, '\n', end - p);
+		if (!newline)
+		{
+			t->partial++;
+			break;
+		}
+		if (newline > p) //log lines are followed by a blank line
+		{
+			t->lines++;
+			parseLine(p, newline, &e);
+			countLine(t, s, &e);
+		}
+		p = newline + 1;
+	}
+}
+
+/*Finds the first line from p to end that starts or resumes a song, or returns end
+*/
+static const char* findBody (const char* p, const char* end, bool* resumes)
+{
+	struct lineEvent e;
+
+	while (p < end)
+	{
+		const char* newline = memchr(p, '\n', end - p);
+		if (!newline)
+			break;
+		if (newline > p)
+		{
+			parseLine(p, newline, &e);
+			if (e.kind == LINE_START || e.kind == LINE_RESUMED)
+			{
+				*resumes = e.kind == LINE_RESUMED;
+				return p;
+			}
+		}
+		p = newline + 1;
+	}
+	return end;
+}
+
+/*Adds the totals in b to a
+*/
+static void addTally (struct tally* a, const struct tally* b)
+{
+	a->lines += b->lines;
+	a->malformed += b->malformed;
+	a->partial += b->partial;
+	a->orphans += b->orphans;
+	if (b->first && (a->first == 0 || b->first < a->first))
+		a->first = b->first;
+	if (b->last > a->last)
+		a->last = b->last;
+
+	for (int h = 0; h < 24; h++)
+	{
+		a->hourSessions[h] += b->hourSessions[h];
+		a->hourCompleted[h] += b->hourCompleted[h];
+		a->hourJudged[h] += b->hourJudged[h];
+		a->hourCorrect[h] += b->hourCorrect[h];
+		a->hourScores[h] += b->hourScores[h];
+		a->hourScoreSum[h] += b->hourScoreSum[h];
+	}
+	a->zeroScores += b->zeroScores;
+
+	for (int s = 0; s < SONG_KINDS; s++)
+	{
+		a->songs[s].sessions += b->songs[s].sessions;
+		a->songs[s].completed += b->songs[s].completed;
+		a->songs[s].interrupted += b->songs[s].interrupted;
+		a->songs[s].resumed += b->songs[s].resumed;
+		a->songs[s].judged += b->songs[s].judged;
+		a->songs[s].correct += b->songs[s].correct;
+		a->songs[s].scoreSum += b->songs[s].scoreSum;
+		if (b->songs[s].best > a->songs[s].best)
+			a->songs[s].best = b->songs[s].best;
+		for (int r = 0; r < MAX_ROWS; r++)
+		{
+			a->rowAttempts[s][r] += b->rowAttempts[s][r];
+			a->rowMisses[s][r] += b->rowMisses[s][r];
+		}
+	}
+	a->closedSessions += b->closedSessions;
+}
+
+/*Orders segments oldest first, and a plain segment before the .gz of the same number
+*/
+static int compareInputs (const void* a, const void* b)
+{
+	const struct input* x = (const struct input*) a;
+	const struct input* y = (const struct input*) b;
+
+	if (x->seq != y->seq)
+		return x->seq < y->seq ? -1 : 1;
+	return x->gz - y->gz;
+}
+
+/*Adds the log at path and its closed segments path.N and path.N.gz to the inputs, oldest
+first. A segment that is there both plain and gzipped is being compressed, so the plain one
+is read. Returns false if there are too many files
+*/
+static bool addLog (struct input* inputs, int* count, const char* path)
+{
+	char dirName[MAX_PATH / 2]; //leaves room in MAX_PATH for a file name
+	const char* baseName;
+	size_t baseLength;
+	DIR* dir;
+	struct dirent* entry;
+	struct stat st;
+	int first = *count;
+	int kept;
+
+	//Split the path into its directory and file name
+	baseName = strrchr(path, '/');
+	if (baseName)
+	{
+		snprintf(dirName, sizeof(dirName), "%.*s", (int) (baseName - path), path);
+		baseName++;
+	}
+	else
+	{
+		snprintf(dirName, sizeof(dirName), ".");
+		baseName = path;
+	}
+	baseLength = strlen(baseName);
+
+	dir = opendir(dirName[0] ? dirName : "/");
+	if (dir)
+	{
+		while ((entry = readdir(dir)) != NULL)
+		{
+			char* end;
+			long seq;
+			bool gz;
+
+			//Only names of the form <baseName>.<seq> or <baseName>.<seq>.gz, never .gz.tmp
+			if (strncmp(entry->d_name, baseName, baseLength) != 0 || entry->d_name[baseLength] != '.')
+				continue;
+			seq = strtol(entry->d_name + baseLength + 1, &end, 10);
+			if (end == entry->d_name + baseLength + 1 || seq < 0)
+				continue;
+			if (strcmp(end, ".gz") == 0)
+				gz = true;
+			else if (*end == '\0')
+				gz = false;
+			else
+				continue;
+
+			if (*count >= MAX_INPUTS)
+			{
+				closedir(dir);
+				return false;
+			}
+			inputs[*count] = (struct input) {.seq = seq, .gz = gz};
+			snprintf(inputs[*count].path, MAX_PATH, "%s/%s", dirName, entry->d_name);
+			(*count)++;
+		}
+		closedir(dir);
+	}
+
+	qsort(inputs + first, *count - first, sizeof(struct input), compareInputs);
+	kept = first;
+	for (int i = first; i < *count; i++)
+		if (i == first || inputs[i].seq != inputs[i - 1].seq)
+			inputs[kept++] = inputs[i];
+	*count = kept;
+
+	//The active log goes last. A plain path that is itself a segment (or a .gz) works too
+	if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		size_t length = strlen(path);
+		if (*count >= MAX_INPUTS)
+			return false;
+		inputs[*count] = (struct input) {.seq = LONG_MAX, .gz = length > 3 && strcmp(path + length - 3, ".gz") == 0};
+		snprintf(inputs[*count].path, MAX_PATH, "%s", path);
+		(*count)++;
+	}
+	return true;
+}
+
+/*Decompresses the gzip data from src into anonymous memory, which grows as it fills. A cut
+off or corrupt stream keeps whatever came out of it before the damage
+*/
+static void inflateInput (struct input* in, const unsigned char* src, size_t size)
+{
+	z_stream zs;
+	size_t capacity = (size * 6 + 65536 + 4095) & ~(size_t) 4095;
+	size_t used = 0;
+	char* out;
+	int ret;
+
+	out = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (out == MAP_FAILED)
+	{
+		in->failed = true;
+		return;
+	}
+
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+	{
+		munmap(out, capacity);
+		in->failed = true;
+		return;
+	}
+	zs.next_in = (unsigned char*) src;
+	zs.avail_in = size;
+
+	while (true)
+	{
+		if (used == capacity)
+		{
+			char* bigger = mremap(out, capacity, capacity * 2, MREMAP_MAYMOVE);
+			if (bigger == MAP_FAILED)
+			{
+				in->damaged = true;
+				break;
+			}
+			out = bigger;
+			capacity *= 2;
+		}
+		zs.next_out = (unsigned char*) out + used;
+		zs.avail_out = capacity - used;
+		ret = inflate(&zs, Z_NO_FLUSH);
+		used = (char*) zs.next_out - out;
+
+		if (ret == Z_STREAM_END)
+		{
+			//gzip files can hold several members one after the other
+			if (zs.avail_in == 0 || inflateReset(&zs) != Z_OK)
+				break;
+		}
+		else if (ret != Z_OK && !(ret == Z_BUF_ERROR && zs.avail_out == 0))
+		{
+			in->damaged = true;
+			break;
+		}
+		else if (zs.avail_in == 0 && zs.avail_out > 0)
+		{
+			in->damaged = true; //the file ends in the middle of the stream
+			break;
+		}
+	}
+	inflateEnd(&zs);
+
+	in->data = out;
+	in->size = used;
+	in->mapped = capacity;
+}
+
+/*Maps one input into memory: plain files directly, .gz files decompressed
+*/
+static void mapInput (struct input* in)
+{
+	struct stat st;
+	void* file;
+	int fd = open(in->path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		if (fd >= 0)
+			close(fd);
+		in->failed = true;
+		return;
+	}
+	in->diskBytes = st.st_size;
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return;
+	}
+
+	file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED)
+	{
+		in->failed = true;
+		return;
+	}
+	madvise(file, st.st_size, MADV_SEQUENTIAL);
+
+	if (in->gz)
+	{
+		inflateInput(in, (const unsigned char*) file, st.st_size);
+		munmap(file, st.st_size);
+	}
+	else
+	{
+		in->data = file;
+		in->size = st.st_size;
+		in->mapped = st.st_size;
+	}
+}
+
+/*A worker thread for the first pass: maps (and decompresses) the next file until there are none left
+*/
+static void* mapWorker (void* arg)
+{
+	struct batch* b = (struct batch*) arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&b->nextInput, 1, __ATOMIC_RELAXED)) < b->inputCount)
+		mapInput(&b->inputs[i]);
+	return NULL;
+}
+
+/*Runs worker on threads threads and waits for them all. The workers take their work from
+b, so if a thread can't be made this one works through what is left instead
+*/
+static void runWorkers (void* (*worker)(void*), struct batch* b, const int threads)
+{
+	pthread_t workers[MAX_THREADS];
+	bool started[MAX_THREADS];
+	int running = 0;
+
+	for (int t = 0; t < threads; t++)
+	{
+		started[t] = pthread_create(&workers[t], NULL, worker, b) == 0;
+		running += started[t];
+	}
+	if (running < threads)
+		worker(b);
+	for (int t = 0; t < threads; t++)
+		if (started[t])
+			pthread_join(workers[t], NULL);
+}
+
+/*A worker thread for the second pass: parses the next chunk until there are none left
+*/
+static void* parseWorker (void* arg)
+{
+	struct batch* b = (struct batch*) arg;
+	int i;
+
+	while ((i = __atomic_fetch_add(&b->nextChunk, 1, __ATOMIC_RELAXED)) < b->chunkCount)
+	{
+		struct chunk* c = &b->chunks[i];
+		c->body = findBody(c->start, c->end, &c->bodyResumes);
+		countLines(&c->t, &c->tail, c->body, c->end);
+	}
+	return NULL;
+}
+
+/*Cuts the inputs into chunks of about CHUNK_BYTES, each ending after a newline. Returns the
+number of chunks, or -1 if there wasn't memory for them
+*/
+static int splitChunks (struct batch* b)
+{
+	long long total = 0;
+	int count = 0;
+
+	for (int i = 0; i < b->inputCount; i++)
+		total += b->inputs[i].size / CHUNK_BYTES + 1;
+	b->chunks = (struct chunk*) calloc(total, sizeof(struct chunk));
+	if (!b->chunks)
+		return -1;
+
+	for (int i = 0; i < b->inputCount; i++)
+	{
+		const char* p = b->inputs[i].data;
+		const char* end = p + b->inputs[i].size;
+
+		while (p < end)
+		{
+			const char* cut = end;
+			if (end - p > CHUNK_BYTES)
+			{
+				const char* newline = memchr(p + CHUNK_BYTES, '\n', end - p - CHUNK_BYTES);
+				cut = newline ? newline + 1 : end;
+			}
+			b->chunks[count].start = p;
+			b->chunks[count].end = cut;
+			count++;
+			p = cut;
+		}
+	}
+	return count;
+}
+
+/*Adds the chunks up in order into total. The lines before each chunk's first song belong to
+the song carried over from the chunks before, so they are read here
+*/
+static void mergeChunks (struct tally* total, struct chunk* chunks, int count)
+{
+	struct session carried;
+
+	memset(&carried, 0, sizeof(carried));
+	for (int i = 0; i < count; i++)
+	{
+		struct chunk* c = &chunks[i];
+
+		countLines(total, &carried, c->start, c->body);
+		if (c->body == c->end)
+			continue;
+
+		//The chunk's first song started without knowing about a "Resumed song" line at the
+		//end of the chunk before, so it is counted as resumed now
+		if (carried.pendingResume && !c->bodyResumes)
+		{
+			if (c->t.closedSessions > 0)
+			{
+				struct songTally* song = &c->t.songs[c->t.firstClosed.song];
+				int score = carried.pendingScore + c->t.firstClosed.correct;
+				song->resumed++;
+				if (c->t.firstClosed.completed)
+				{
+					song->scoreSum += carried.pendingScore;
+					if (score > song->best)
+						song->best = score;
+				}
+			}
+			else
+			{
+				c->tail.resumed = true;
+				c->tail.baseScore = carried.pendingScore;
+			}
+		}
+
+		//The chunk starts a new song, so one still going was interrupted
+		sessionClose(total, &carried, false, true);
+		addTally(total, &c->t);
+		carried = c->tail;
+	}
+	sessionClose(total, &carried, false, false);
+}
+
+/*Formats a time kept as YYYYMMDDhhmmss the way the log writes it
+*/
+static void formatStamp (long long stamp, char* buffer, size_t size)
+{
+	snprintf(buffer, size, "%02lld-%02lld-%04lld %02lld:%02lld:%02lld", stamp / 100000000 % 100,
+		stamp / 1000000 % 100, stamp / 10000000000LL, stamp / 10000 % 100, stamp / 100 % 100, stamp % 100);
+}
+
+/*A percentage, or 0 when there is nothing to take it of
+*/
+static double percent (long long part, long long whole)
+{
+	return whole ? 100.0 * part / whole : 0;
+}
+
+/*True if row r of song s was missed more often (relatively) than row wr of song ws
+*/
+static bool missedMore (const struct tally* t, int s, int r, int ws, int wr)
+{
+	return t->rowMisses[s][r] * t->rowAttempts[ws][wr] > t->rowMisses[ws][wr] * t->rowAttempts[s][r];
+}
+
+/*Prints the three tables
+*/
+static void printTables (const struct tally* t)
+{
+	char first[40], last[40];
+	int worst[HOTSPOTS][2];
+	int found = 0;
+
+	formatStamp(t->first, first, sizeof(first));
+	formatStamp(t->last, last, sizeof(last));
+	printf("Logs from %s to %s: %lld lines, %lld malformed, %lld cut off, %lld responses outside a song\n\n",
+		t->first ? first : "-", t->last ? last : "-", t->lines, t->malformed, t->partial, t->orphans);
+
+	printf("Sessions per hour\n");
+	printf("hour  sessions  completed  accuracy  scores  mean score\n");
+	for (int h = 0; h < 24; h++)
+	{
+		if (!t->hourSessions[h] && !t->hourCompleted[h] && !t->hourScores[h])
+			continue;
+		printf("%02d    %8lld  %9lld  %7.1f%%  %6lld  %10.1f\n", h, t->hourSessions[h], t->hourCompleted[h],
+			percent(t->hourCorrect[h], t->hourJudged[h]), t->hourScores[h],
+			t->hourScores[h] ? (double) t->hourScoreSum[h] / t->hourScores[h] : 0);
+	}
+	printf("(%lld scores of 00 aren't counted, the game writes one at every startup)\n\n", t->zeroScores);
+
+	printf("Accuracy per song\n");
+	printf("song     sessions  completed  interrupted  resumed  judged  accuracy  mean score  best\n");
+	for (int s = 0; s < SONG_KINDS; s++)
+	{
+		const struct songTally* song = &t->songs[s];
+		if (!song->sessions && !song->judged)
+			continue;
+		printf("%-7s  %8lld  %9lld  %11lld  %7lld  %6lld  %7.1f%%  %10.1f  %4d\n", songNames[s], song->sessions,
+			song->completed, song->interrupted, song->resumed, song->judged, percent(song->correct, song->judged),
+			song->completed ? (double) song->scoreSum / song->completed : 0, song->best);
+	}
+
+	printf("\nMiss hotspots (percent of responses to each row that were wrong)\n");
+	printf("row  easy     medium   hard     unknown\n");
+	for (int r = 0; r < MAX_ROWS; r++)
+	{
+		bool any = false;
+		for (int s = 0; s < SONG_KINDS; s++)
+			any = any || t->rowAttempts[s][r];
+		if (!any)
+			continue;
+		printf("%3d", r + 1);
+		for (int s = 0; s < SONG_KINDS; s++)
+		{
+			if (t->rowAttempts[s][r])
+				printf("  %6.1f%%", percent(t->rowMisses[s][r], t->rowAttempts[s][r]));
+			else
+				printf("  %7s", "-");
+		}
+		printf("\n");
+	}
+
+	//The rows missed the most often, out of those played at least a few times
+	for (int s = 0; s < SONG_KINDS; s++)
+	{
+		for (int r = 0; r < MAX_ROWS; r++)
+		{
+			int slot = found < HOTSPOTS ? found : HOTSPOTS - 1;
+			if (t->rowAttempts[s][r] < 5 || !t->rowMisses[s][r])
+				continue;
+			if (found == HOTSPOTS && !missedMore(t, s, r, worst[slot][0], worst[slot][1]))
+				continue;
+			//Insertion sort, worst first
+			while (slot > 0 && missedMore(t, s, r, worst[slot - 1][0], worst[slot - 1][1]))
+			{
+				worst[slot][0] = worst[slot - 1][0];
+				worst[slot][1] = worst[slot - 1][1];
+				slot--;
+			}
+			worst[slot][0] = s;
+			worst[slot][1] = r;
+			if (found < HOTSPOTS)
+				found++;
+		}
+	}
+	printf("\nMost missed:");
+	for (int i = 0; i < found; i++)
+		printf(" %s row %d (%.1f%%)%s", songNames[worst[i][0]], worst[i][1] + 1,
+			percent(t->rowMisses[worst[i][0]][worst[i][1]], t->rowAttempts[worst[i][0]][worst[i][1]]),
+			i + 1 < found ? "," : "");
+	printf("%s\n", found ? "" : " none yet");
+}
+
+/*Seconds from start to end
+*/
+static double secondsBetween (const struct timespec* start, const struct timespec* end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main (const int argc, const char* const argv[])
+{
+	static struct input inputs[MAX_INPUTS];
+	static struct tally total;
+	struct batch b = {.inputs = inputs, .inputCount = 0, .nextInput = 0, .nextChunk = 0};
+	struct timespec start, mapped, parsed;
+	long long diskBytes = 0, textBytes = 0;
+	int threads = 0;
+	int damaged = 0, failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "Usage: %s [--threads N] LOG...\n", argv[0]);
+			return 2;
+		}
+		else if (!addLog(inputs, &b.inputCount, argv[i]))
+		{
+			fprintf(stderr, "Only the first %d files will be read\n", MAX_INPUTS);
+			break;
+		}
+	}
+	if (b.inputCount == 0)
+	{
+		fprintf(stderr, "Nothing to read (give the game log and the score log)\n");
+		return 2;
+	}
+
+	//One thread per core by default, but never more than MAX_THREADS
+	if (threads < 1)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	runWorkers(mapWorker, &b, threads);
+
+	for (int i = 0; i < b.inputCount; i++)
+	{
+		if (inputs[i].failed)
+		{
+			fprintf(stderr, "%s could not be read\n", inputs[i].path);
+			failed++;
+		}
+		else if (inputs[i].damaged)
+		{
+			fprintf(stderr, "%s is cut off or damaged, only the first %zu bytes were read\n", inputs[i].path, inputs[i].size);
+			damaged++;
+		}
+		diskBytes += inputs[i].diskBytes;
+		textBytes += inputs[i].size;
+	}
+
+	b.chunkCount = splitChunks(&b);
+	if (b.chunkCount < 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &mapped);
+
+	runWorkers(parseWorker, &b, threads);
+	mergeChunks(&total, b.chunks, b.chunkCount);
+	clock_gettime(CLOCK_MONOTONIC, &parsed);
+
+	printTables(&total);
+
+	double parseSeconds = secondsBetween(&mapped, &parsed);
+	double allSeconds = secondsBetween(&start, &parsed);
+	fprintf(stderr, "%d files (%d damaged, %d unreadable), %.1f MB on disk, %.1f MB of text in %d chunks\n",
+		b.inputCount, damaged, failed, diskBytes / 1e6, textBytes / 1e6, b.chunkCount);
+	fprintf(stderr, "Parsed in %.3f s on %d threads: %.2f GB/s, %.3f s with mapping and decompression: %.2f GB/s\n",
+		parseSeconds, threads, textBytes / parseSeconds / 1e9, allSeconds, textBytes / allSeconds / 1e9);
+
+	for (int i = 0; i < b.inputCount; i++)
+		if (inputs[i].mapped)
+			munmap((void*) inputs[i].data, inputs[i].mapped);
+	free(b.chunks);
+	return failed ? 1 : 0;
+}
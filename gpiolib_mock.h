@@ -0,0 +1,76 @@
+/*
+ * An in-memory stand-in for gpiolib_addr.h, gpiolib_reg.h and gpiolib_reg.c.
+ * It is only used when GuitarZero.c is compiled with GZ_MOCK_GPIO defined (for example
+ * by the benchmark in GuitarZeroBench.c) so that the hardware functions can run on an
+ * ordinary Linux machine without a Pi. The "register file" is a plain array with the
+ * same word layout as the BCM2835 GPIO block.
+ */
+#ifndef GPIOLIB_MOCK_H
+#define GPIOLIB_MOCK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+//Word offsets of the registers we use, matching the BCM2835 peripheral layout
+#define GPFSEL(x) (0 + (x))
+#define GPSET(x) (7 + (x))
+#define GPCLR(x) (10 + (x))
+#define GPLEV(x) (13 + (x))
+
+//Number of 32 bit registers in the GPIO block
+#define GPIO_MOCK_REGS 41
+
+/*A structure that represents the mock GPIO block. It only holds the register words
+*/
+typedef struct
+{
+	volatile uint32_t regs[GPIO_MOCK_REGS];
+} GPIO_Mock;
+
+typedef GPIO_Mock* GPIO_Handle;
+
+/*Allocates a zeroed register file. Returns NULL if the allocation failed
+*/
+static GPIO_Handle gpiolib_init_gpio(void)
+{
+	return (GPIO_Handle) calloc(1, sizeof(GPIO_Mock));
+}
+
+/*Frees a register file returned by gpiolib_init_gpio
+*/
+static void gpiolib_free_gpio(GPIO_Handle gpio)
+{
+	free((void*) gpio);
+}
+
+/*Returns the value of the register at the given word offset
+*/
+static uint32_t gpiolib_read_reg(GPIO_Handle gpio, uint32_t offset)
+{
+	return gpio->regs[offset];
+}
+
+/*Writes a register. Like the real hardware, writing to GPSET or GPCLR only changes the
+bits that are 1 in data, and the change shows up in the matching GPLEV register
+*/
+static void gpiolib_write_reg(GPIO_Handle gpio, uint32_t offset, uint32_t data)
+{
+	if (offset == GPSET(0) || offset == GPSET(1))
+		gpio->regs[GPLEV(offset - GPSET(0))] |= data;
+	else if (offset == GPCLR(0) || offset == GPCLR(1))
+		gpio->regs[GPLEV(offset - GPCLR(0))] &= ~data;
+	else
+		gpio->regs[offset] = data;
+}
+
+/*Test helper that drives an input pin high or low, as a button or the diode would
+*/
+static void gpiolib_mock_set_level(GPIO_Handle gpio, int pin, int high)
+{
+	if (high)
+		gpio->regs[GPLEV(pin/32)] |= 1u << (pin%32);
+	else
+		gpio->regs[GPLEV(pin/32)] &= ~(1u << (pin%32));
+}
+
+#endif